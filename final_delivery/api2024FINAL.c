@@ -1,16 +1,69 @@
 //
 // Created by diego on 10/30/24.
 //
+#include <limits.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_DISPATCH
+#endif
+#ifdef STATS
+#include <time.h>
+#endif
 
 #define MAX_NAME_LENGTH 35
-#define RECIPE_TABLE_SIZE 500000
-#define INGREDIENT_TABLE_SIZE 5000
-#define MAX_INGREDIENT_RETRIES 25
-#define MAX_RECIPE_RETRIES 35
+#define HASH_GROUP_WIDTH 16              // Byte di controllo confrontati insieme con una istruzione SIMD
+#define HASH_TABLE_INITIAL_CAPACITY 64  // Capacità iniziale delle hash table (potenza di 2, multiplo del gruppo)
+#define HASH_TABLE_MAX_LOAD 87            // Percentuale massima di slot occupati (elementi + tombstone)
+#define CTRL_EMPTY 0x80                   // Byte di controllo di uno slot vuoto
+#define CTRL_DELETED 0xFE                 // Byte di controllo di un tombstone
+#define INPUT_CHUNK_SIZE (1 << 20)        // Byte letti per volta quando l'input non è un file mappabile
+#define OUTPUT_BUFFER_SIZE (1 << 16)      // Byte accumulati prima di scrivere su stdout
+#define READY_QUEUE_INITIAL_CAPACITY 4096 // Tick coperti inizialmente dalla coda degli ordini pronti
+#define SNAPSHOT_MAGIC "PASTICC1"         // Intestazione dei file di snapshot
+#define SNAPSHOT_VERSION 1
+#define JOURNAL_MAGIC "PASTJRN1"          // Intestazione dei file di giornale
+#define JOURNAL_VERSION 1
+#define JOURNAL_GROUP_COMMIT 4096         // Record accumulati prima di un fdatasync
+#define JOURNAL_RECORD_COURIER 100        // Record del giornale: corriere passato a fine input
+#define PIPELINE_BATCH_COMMANDS 1024    // Comandi passati insieme dal thread di lettura al simulatore
+#define PIPELINE_BATCH_TEXT (1 << 16)     // Byte di righe copiabili in un gruppo (input non mappato)
+#define PIPELINE_BATCHES 4                // Gruppi di comandi in circolo nella pipeline
+#define PIPELINE_BLOCKS 8                 // Blocchi di risposte in circolo nella pipeline
+#define PIPELINE_RING_SIZE 16             // Slot delle code tra i thread (più degli elementi in circolo)
+#define SERVER_BATCH 256                  // Comandi eseguiti dal servizio prima di rendere durevoli le risposte
+#define SERVER_EVENTS 64                  // Eventi letti da una chiamata a epoll_wait
+#define SERVER_READ_SIZE (1 << 16)        // Byte letti per volta da un client
+#define SPSC_SPINS 64                     // Tentativi a vuoto su una coda prima di cedere il processore
+#define ORDER_STORE_INITIAL_CAPACITY 4096 // Ordini per cui è allocata inizialmente la tabella degli ordini
+#define NO_ORDER 0                        // ID nullo: lo slot 0 della tabella degli ordini non viene usato
+#define ARENA_CHUNK_SIZE (1 << 16)        // Byte allocati per volta dall'arena del catalogo
+#define ARENA_MIN_CLASS 4                 // La classe più piccola dell'arena è di 16 byte
+#define ARENA_CLASSES 32                  // Classi di dimensione dell'arena (potenze di 2)
+#define CACHE_LINE_SIZE 64
+#define MEMORY_COMPACT_MARGIN 8           // Con --max-memory si compatta oltre il limite meno 1/8
+#define LOT_INLINE_CAPACITY 5             // Lotti nel calendario stesso: con l'intestazione riempiono una riga di cache
+#define REQUIREMENT_LANES 8               // Gli ingredienti di una ricetta sono allineati a gruppi di 8 (un registro AVX2)
 
 // ****____****____****____****____**** STRUTTURE DATI ****____****____****____****____****
 
@@ -20,59 +73,613 @@ typedef struct {
     int expiration;
 } Lot;
 
-// Nodo del Min-Heap per i lotti
+// Calendario dei lotti di un ingrediente: un lotto per scadenza, ordinati per scadenza crescente.
+// Finché bastano, i lotti stanno in inline_lots, nella stessa riga di cache dell'intestazione
 typedef struct {
-    Lot *lots;  // Array di lotti
-    int size;   // Dimensione del min-heap
-    int capacity; // Capacità massima del min-heap
-} MinHeap_lots;
+    Lot *lots;     // Lotti validi in lots[head, size): inline_lots oppure un array nell'arena
+    int head;      // Primo lotto non ancora consumato o scaduto
+    int size;
+    int capacity;
+    Lot inline_lots[LOT_INLINE_CAPACITY];
+} LotCalendar;
+
+// ID di un ordine: indice nella tabella degli ordini
+typedef unsigned int OrderId;
+struct Recipe;
+
+// Ricetta con ordini in attesa che usa un ingrediente (indice di dipendenza)
+typedef struct {
+    struct Recipe *recipe;
+    int slot;  // Posizione dell'ingrediente negli array degli ingredienti della ricetta
+} WaitingRecipe;
 
-// Struttura per un ingrediente con nome e min-heap dei lotti
+// Struttura per un ingrediente: la prima riga di cache contiene solo i lotti, letti da ogni
+// preparazione; nome e indice di attesa, usati raramente, stanno nella seconda
 typedef struct {
+    _Alignas(CACHE_LINE_SIZE) LotCalendar lots;  // Lotti di quell'ingrediente, dal più vicino alla scadenza
     char *name;   // Nome dell'ingrediente
-    MinHeap_lots *heap;  // Min-Heap dei lotti di quell'ingrediente
-    int total_quantity;
+    int scheduled_expiration;  // Scadenza con cui l'ingrediente è nella coda delle scadenze (INT_MAX se assente)
+    WaitingRecipe *waiting;  // Ricette con ordini in attesa che richiedono l'ingrediente
+    int waiting_size;
+    int waiting_capacity;
 } Ingredient;
-//TODO per velocizzare potrei mettere puntatore al posto di hash
-// Nodo per la lista di ingredienti di una ricetta
-typedef struct IngredientNode {
-    char *name;  // Nome dell'ingrediente
-    unsigned int hash;
-    int quantity;  // Quantità richiesta per la ricetta
-    //struct IngredientNode *next;  // Puntatore al prossimo ingrediente
-} IngredientNode;
 
-// Ricetta: Nome e lista di ingredienti
+// Lista semplice di ordini collegati tramite la colonna next della tabella degli ordini
 typedef struct {
+    OrderId head;  // Testa della lista (NO_ORDER se vuota)
+    OrderId tail;  // Coda della lista
+} OrderList;
+
+// Ricetta: Nome e lista di ingredienti
+typedef struct Recipe {
     char *name;   // Nome della ricetta
+    int id;       // ID denso della ricetta, riusato dopo la rimozione
     int weight;  // Peso della ricetta
     int last_quantity_failed;
     int last_tick_check;
     int ingredients_size;
-    IngredientNode *ingredients;  // array degli ingredienti richiesti
+    // Ingredienti richiesti in array paralleli, riempiti fino a un multiplo di REQUIREMENT_LANES
+    int *ingredient_ids;         // ID densi degli ingredienti (il riempimento ripete il primo)
+    int *ingredient_quantities;  // Quantità richieste per una unità (0 nel riempimento)
+    int *waiting_positions;      // Posizione della ricetta nell'array waiting dell'ingrediente (-1 se assente)
+    OrderList pending_orders;  // Ordini in attesa della ricetta in ordine cronologico
+    OrderId cursor;         // Prossimo ordine da controllare durante un rifornimento
+    OrderId cursor_before;  // Ordine rimasto in attesa che precede cursor (NO_ORDER se è la testa)
+    int candidate_tick;  // Tick dell'ultimo rifornimento in cui è stata messa tra le candidate
+    int outstanding_orders;  // Ordini della ricetta non ancora spediti (in attesa o pronti)
+    int waiting_orders;      // Ordini della ricetta in attesa di ingredienti
+    int snapshot_index;  // Posizione della ricetta nello snapshot in scrittura
+    int max_makeable;  // Quantità massima producibile con le scorte attuali
+    unsigned long long max_makeable_epoch;  // Valore di stock_epoch per cui max_makeable è valido
 } Recipe;
 
-// Nodo per la lista doppiamente collegata degli ordini
-typedef struct OrderNode {
+// Tabella degli ordini in colonne parallele indicizzate per OrderId: 16 byte per ordine
+typedef struct {
+    unsigned int *recipe;  // ID della ricetta
+    int *quantity;         // Numero di elementi ordinati
+    int *tick;             // Istante di arrivo dell'ordine
+    OrderId *next;         // Successivo nella lista d'attesa della ricetta o nella free list
+    OrderId free_list;     // Ordini spediti, riusati prima di quelli mai usati
+    unsigned int size;     // ID mai usati a partire da size
+    unsigned int capacity;
+    unsigned int live;     // Ordini in attesa o pronti
+} OrderStore;
+
+// Coda degli ordini pronti indicizzata per tick di arrivo: buffer circolare con bitmap di occupazione
+typedef struct{
+    OrderId *orders;           // orders[tick & (capacity - 1)]
+    unsigned long long *bits;     // Un bit per slot occupato
+    unsigned long long *summary;  // Un bit per ogni parola di bits non nulla
+    int capacity;  // Numero di slot, potenza di 2: supera sempre max_tick - min_tick
+    int size;      // Ordini presenti
+    int min_tick;  // Tick dell'ordine più vecchio (valido se size > 0)
+    int max_tick;  // Tick dell'ordine più recente (valido se size > 0)
+    long long *weight_tree;  // Albero di Fenwick dei pesi degli ordini per slot (indici da 1)
+    int *count_tree;         // Albero di Fenwick del numero di ordini per slot
+    long long total_weight;  // Peso di tutti gli ordini pronti
+    int wide_tick;  // Ultimo passaggio del corriere in cui serviva tutta la capacità (-1 dopo una crescita)
+}ReadyQueue;
+
+// Nome da cercare nelle hash table, con lunghezza e hash calcolati una sola volta
+typedef struct {
+    const char *str;
+    unsigned int length;
+    unsigned int hash;
+} NameKey;
+
+// Valore associato a un nome: puntatore alla ricetta o ID denso dell'ingrediente
+typedef union {
+    void *pointer;
+    int id;
+} HashValue;
+
+// Slot della hash table: nome copiato inline (o puntatore se troppo lungo), hash e valore
+typedef struct {
+    union {
+        char name[MAX_NAME_LENGTH + 1];  // Nome terminato da '\0' se lungo al massimo MAX_NAME_LENGTH
+        struct {
+            char marker;            // '\0': il nome non sta nello slot
+            const char *long_name;  // Nome del proprietario (ricetta o ingrediente)
+        } external;
+    };
+    unsigned int hash;
+    HashValue value;
+} HashSlot;
+
+// Hash table in stile Swiss table: un byte di controllo per slot, scansione a gruppi di 16
+typedef struct {
+    unsigned char *ctrl;  // CTRL_EMPTY, CTRL_DELETED oppure i 7 bit bassi dell'hash
+    HashSlot *slots;
+    unsigned int capacity;  // Numero di slot, sempre potenza di 2 (0 se non ancora allocata)
+    unsigned int size;      // Elementi presenti
+    unsigned int used;      // Slot non vuoti: elementi più tombstone
+} HashTable;
+
+// Tipo di comando, riconosciuto dai primi byte della riga
+typedef enum {
+    CMD_AGGIUNGI_RICETTA,
+    CMD_RIMUOVI_RICETTA,
+    CMD_RIFORNIMENTO,
+    CMD_ORDINE,
+    CMD_SCONOSCIUTO,
+    // Interrogazioni: leggono lo stato senza modificarlo e senza consumare un tick
+    CMD_SCORTA,              // scorta <ingrediente>
+    CMD_IN_SOSPESO,          // in_sospeso <ricetta>
+    CMD_PESO_PRONTI,         // peso_pronti
+    CMD_PROSSIMO_CORRIERE    // prossimo_corriere
+} CommandType;
+
+// Coppia nome-numeri di un comando: ingrediente e quantità di una ricetta, oppure lotto di un rifornimento
+typedef struct {
+    NameKey name;
+    int quantity;
+    int expiration;  // Solo per i lotti del rifornimento
+} CommandItem;
+
+// Comando già analizzato: i nomi puntano direttamente nel buffer di input
+typedef struct {
+    CommandType type;
+    NameKey name;        // Ricetta (o parola del comando se non riconosciuto)
+    int quantity;        // Elementi ordinati
+    CommandItem *items;  // Ingredienti della ricetta o lotti del rifornimento
+    int items_size;
+    int items_capacity;
+} Command;
+
+// Lettore dell'input: file mappato in memoria oppure buffer riempito a blocchi
+typedef struct {
+    char *data;
+    size_t size;      // Byte validi in data
+    size_t capacity;  // Dimensione del buffer (0 se il file è mappato)
+    size_t pos;       // Inizio della prossima riga
+    int fd;
+    bool mapped;
+    bool eof;
+} InputScanner;
+
+// Coda circolare lock-free con un solo produttore e un solo consumatore
+typedef struct {
+    void **slots;
+    size_t mask;                // Numero di slot - 1 (potenza di 2)
+    _Alignas(64) size_t head;   // Prossimo elemento da prelevare, scritto solo dal consumatore
+    _Alignas(64) size_t tail;   // Prossimo slot da riempire, scritto solo dal produttore
+} SpscRing;
+
+// Gruppo di comandi già analizzati passato dal thread di lettura al simulatore
+typedef struct {
+    Command commands[PIPELINE_BATCH_COMMANDS];  // Gli array items vengono riusati dal gruppo
+    int size;
+    char *text;  // Copia delle righe se l'input non è mappato: i nomi dei comandi puntano qui
+    size_t text_size;
+    size_t text_capacity;
+} CommandBatch;
+
+// Blocco di risposte, passato al thread di scrittura nel modo pipeline
+typedef struct {
+    size_t size;
+    char data[OUTPUT_BUFFER_SIZE];
+} OutputBlock;
+
+// Pipeline lettura -> simulazione -> scrittura (--pipeline)
+typedef struct Pipeline {
+    SpscRing parsed;        // Gruppi da eseguire, NULL a fine input
+    SpscRing free_batches;  // Gruppi eseguiti, da riempire di nuovo
+    SpscRing filled;        // Blocchi di risposte da scrivere, NULL a fine simulazione
+    SpscRing free_blocks;   // Blocchi già scritti
+    InputScanner *input;
+    int output_fd;
+} Pipeline;
+
+// Byte accumulati in un buffer che cresce
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} ByteBuffer;
+
+// Buffer delle risposte, scritto a blocchi
+typedef struct {
+    char *data;           // Dati del blocco corrente
+    size_t size;
+    OutputBlock *block;   // Blocco corrente: own_block, oppure un blocco della pipeline
+    struct Pipeline *pipeline;  // Se non NULL i blocchi pieni vanno al thread di scrittura
+    ByteBuffer *capture;  // Se non NULL le risposte vengono accumulate qui (modo servizio)
+    int fd;  // Destinazione delle risposte (stdout, o il file di uscita nel modo a lotti)
+    bool flush_each_command;  // Uso interattivo: svuota il buffer dopo ogni comando
+    bool discard;  // Riesecuzione del giornale: le risposte sono già state date e vengono scartate
+    OutputBlock own_block;
+} OutputBuffer;
+
+// Scrittura bufferizzata di un file binario
+typedef struct {
+    int fd;
+    bool failed;  // Una scrittura è fallita: il file non è valido
+    size_t size;
+    char data[OUTPUT_BUFFER_SIZE];
+} BinaryWriter;
+
+// Giornale dei comandi: ogni comando viene registrato in binario dopo l'analisi
+typedef struct {
+    BinaryWriter *writer;  // NULL se il giornale non è attivo
+    const char *path;
+    int pending_records;   // Record scritti dopo l'ultimo fdatasync
+    long compaction_interval;  // Comandi tra due compattazioni (0: mai)
+    long records_since_compaction;
+} Journal;
+
+// Lettura di un file binario mappato in memoria
+typedef struct {
+    const char *data;
+    size_t size;
+    size_t pos;
+    bool failed;  // Il file è finito prima del previsto o contiene valori non validi
+} BinaryReader;
+
+// Evento di scadenza: l'ingrediente ha un lotto che scade a expiration
+typedef struct {
+    int expiration;
+    int ingredient;  // ID dell'ingrediente
+} Expiration;
+
+// Min-Heap degli eventi di scadenza, uno per la scadenza più vicina di ogni ingrediente
+typedef struct {
+    Expiration *events;
+    int size;
+    int capacity;
+} MinHeap_expirations;
+
+// Ordine scelto dal corriere, con il peso già calcolato per l'ordinamento
+typedef struct {
+    int weight;
+    OrderId order;
+} CourierRecord;
+
+// Carico del corriere: array contiguo di ordini più un array di appoggio per il radix sort
+typedef struct {
+    CourierRecord *records;
+    CourierRecord *scratch;
+    int size;
+    int capacity;
+} CourierBatch;
+
+// Ricetta candidata al ricontrollo con il tick del prossimo ordine da controllare
+typedef struct {
+    int tick;
     Recipe *recipe;
-    int quantity;  // Numero di elementi ordinati
-    int tick; // Istante di arrivo dell'ordine
-    struct OrderNode *prev;  // Puntatore al nodo precedente
-    struct OrderNode *next;  // Puntatore al nodo successivo
-} OrderNode;
-
-// Struct per gestire una lista di ordini (ordini_in_attesa e ordini_pronti)
-typedef struct OrderList {
-    OrderNode *head;  // Testa della lista
-    OrderNode *tail;  // Coda della lista
-} OrderList;
+} CandidateRecipe;
 
-// Min-Heap per gli ordini pronti
-typedef struct{
-    OrderNode **orders;  // Array di ordini
-    int size;   // Dimensione del min-heap
-    int capacity; // Capacità massima del min-heap
-}MinHeap_orders;
+// Min-Heap delle ricette da ricontrollare dopo un rifornimento, ordinate per tick del prossimo ordine
+typedef struct {
+    CandidateRecipe *recipes;
+    int size;
+    int capacity;
+} MinHeap_recipes;
+
+// Blocco di memoria di un allocatore, collegato agli altri per il rilascio in blocco
+typedef struct MemoryChunk {
+    struct MemoryChunk *next;
+    size_t size;  // Byte utilizzabili dopo l'intestazione
+} MemoryChunk;
+
+// Arena per nomi e array del catalogo: allocazione a puntatore con free list per classe di dimensione
+typedef struct {
+    void *free_lists[ARENA_CLASSES];  // Blocchi liberati, uno stack per ogni potenza di 2
+    char *cursor;
+    char *end;
+    MemoryChunk *chunks;
+    size_t bytes;  // Byte chiesti al sistema dai blocchi
+} Arena;
+
+// Sottosistemi per cui viene contata la memoria
+typedef enum {
+    MEMORY_CATALOG,  // Hash table, ingredienti, ricette e nomi
+    MEMORY_LOTS,     // Lotti fuori riga e coda delle scadenze
+    MEMORY_PENDING,  // Ordini in attesa, righe libere della tabella degli ordini e ricette candidate
+    MEMORY_READY,    // Ordini pronti, coda degli ordini pronti e carico del corriere
+    MEMORY_SUBSYSTEMS
+} MemorySubsystem;
+
+// Stato completo di una simulazione: più pasticcerie indipendenti possono girare in thread diversi
+typedef struct {
+    HashTable ingredient_table;  // Hash Table nome -> ID degli ingredienti
+    Ingredient *ingredient_by_id;  // Ingredienti indicizzati per ID denso
+    int *ingredient_stock;         // Quantità disponibile di ogni ingrediente, per ID denso
+    int ingredient_count;
+    int ingredient_capacity;
+    HashTable recipe_table;        // Hash Table per le ricette
+    Recipe **recipe_by_id;         // Ricette indicizzate per ID (NULL se l'ID è libero)
+    int *free_recipe_ids;          // Pila degli ID liberati dalle rimozioni
+    int recipe_count;              // ID assegnati almeno una volta
+    int free_recipe_count;
+    int recipe_capacity;
+    MinHeap_recipes candidate_recipes;     // Ricette da ricontrollare al rifornimento
+    MinHeap_expirations expiration_queue;  // Coda delle prossime scadenze degli ingredienti
+    CourierBatch orders_to_load;  // Ordini pronti da ordinare prima di spedizione
+    int last_supply_tick;
+    unsigned long long stock_epoch;  // Cresce a ogni variazione delle scorte, invalida i max_makeable
+    OrderStore orders;    // Ordini in attesa e pronti
+    Arena catalog_arena;  // Nomi, ricette, array di ingredienti e indici di attesa
+    Arena lot_arena;      // Lotti che non stanno inline nel calendario
+    size_t memory_after_compaction;  // Memoria contata dopo l'ultima compattazione per --max-memory
+    int memory_compactions;
+    bool memory_limit_exceeded;      // Il limite è stato superato anche dopo una compattazione
+    OutputBuffer output;  // Risposte in attesa di essere scritte
+} Bakery;
+
+// File del modo a lotti, con la dimensione usata per distribuirli tra i thread
+typedef struct {
+    off_t size;
+    int index;  // Posizione del file tra gli argomenti
+} BatchFile;
+
+// Nodo di una coda MPSC intrusiva, primo campo degli elementi accodati
+typedef struct MpscNode {
+    struct MpscNode *next;
+} MpscNode;
+
+// Coda lock-free a più produttori e un consumatore (Vyukov): i produttori scambiano head,
+// il consumatore avanza tail; stub tiene la coda non vuota
+typedef struct {
+    _Alignas(64) MpscNode *head;  // Ultimo nodo inserito
+    _Alignas(64) MpscNode *tail;  // Prossimo nodo da prelevare, usato solo dal consumatore
+    MpscNode stub;
+} MpscQueue;
+
+struct ServerClient;
+struct IntakeThread;
+
+// Comando ricevuto da un client, con la risposta prodotta dal simulatore
+typedef struct {
+    MpscNode node;
+    struct ServerClient *client;
+    struct IntakeThread *intake;  // Thread che ha ricevuto il comando e ne invierà la risposta
+    char *line;
+    size_t length;
+    ByteBuffer response;
+} ServerRequest;
+
+// Client connesso, usato solo dal thread di ricezione che lo ha accettato
+typedef struct ServerClient {
+    int fd;                 // -1 dopo la chiusura, finché ci sono comandi senza risposta
+    ByteBuffer input;       // Dati ricevuti non ancora divisi in righe
+    ByteBuffer output;      // Risposte non ancora inviate, a partire da output_sent
+    size_t output_sent;
+    int pending;            // Comandi passati al simulatore senza risposta
+    unsigned int events;    // Eventi epoll attesi
+    bool read_closed;       // Il client non invierà altri comandi
+    struct ServerClient *next;
+} ServerClient;
+
+// Thread di ricezione: accetta client, legge i comandi e invia le risposte
+typedef struct IntakeThread {
+    struct Server *server;
+    pthread_t thread;
+    int epoll_fd;
+    int wake_fd;               // eventfd: risposte pronte o arresto
+    MpscQueue completions;     // Richieste con la risposta, dal simulatore
+    ServerClient *clients;
+    int closed_clients;        // Client chiusi ancora da liberare
+    bool notify;               // Risposte accodate dall'ultima sveglia (usato solo dal simulatore)
+} IntakeThread;
+
+// Modo servizio (--servizio)
+typedef struct Server {
+    int listen_fd;
+    int wake_fd;         // eventfd del simulatore: nuovi comandi o arresto
+    MpscQueue requests;  // Comandi dai thread di ricezione al simulatore
+    IntakeThread *intakes;
+    int intake_count;
+    int stop;            // Arresto dei thread di ricezione (letto e scritto in modo atomico)
+} Server;
+
+// Coda di file di un thread: il proprietario preleva dalla testa, gli altri thread rubano dal fondo
+typedef struct {
+    int *files;  // Indici dei file, dal più grande al più piccolo
+    int head;
+    int tail;
+    pthread_mutex_t lock;
+} WorkQueue;
+
+// Esecuzione a lotti condivisa dai thread
+typedef struct {
+    char **paths;
+    WorkQueue *queues;
+    int workers;
+    int failures;  // File non elaborati (aggiornato in modo atomico)
+} BatchRun;
+
+// Argomento di un thread del lotto
+typedef struct {
+    BatchRun *run;
+    int index;  // Coda di proprietà del thread
+} BatchWorker;
+
+// ****____****____****____****____**** STATISTICHE ****____****____****____****____****
+
+// Strumentazione opzionale (compilare con -DSTATS): contatori e istogrammi logaritmici,
+// stampati su stderr in testo e JSON all'uscita o alla ricezione di SIGUSR1.
+// Senza STATS le macro non generano codice.
+#ifdef STATS
+
+typedef enum {
+    STAT_HASH_LOOKUPS,         // Ricerche nelle hash table
+    STAT_HASH_GROUPS_PROBED,   // Gruppi di controllo visitati dalle ricerche
+    STAT_HASH_RESIZES,
+    STAT_RESTOCKS,
+    STAT_CANDIDATES,           // Ricette ricontrollate dopo i rifornimenti
+    STAT_CANDIDATES_SCREENED_OUT,  // Scartate dalla verifica vettoriale
+    STAT_PENDING_SCANNED,      // Ordini in attesa esaminati da check_orders
+    STAT_ORDERS_MADE_ON_RESTOCK,
+    STAT_LOTS_CONSUMED,        // Lotti esauriti dalla preparazione degli ordini
+    STAT_LOTS_EXPIRED,
+    STAT_LOT_RESIZES,          // Riallocazioni o compattazioni dei calendari dei lotti
+    STAT_EXPIRY_EVENTS,        // Eventi estratti dalla coda delle scadenze
+    STAT_READY_QUEUE_RESIZES,
+    STAT_COURIER_ORDERS,       // Ordini caricati dal corriere
+    STAT_SHRINKS,              // Contenitori ridotti per bassa occupazione
+    STAT_COUNTERS
+} StatCounter;
+
+const char *const stat_counter_names[STAT_COUNTERS] = {
+    "hash_lookups", "hash_groups_probed", "hash_resizes", "restocks", "candidates",
+    "candidates_screened_out", "pending_scanned", "orders_made_on_restock", "lots_consumed",
+    "lots_expired", "lot_resizes", "expiry_events", "ready_queue_resizes", "courier_orders", "shrinks",
+};
+
+typedef enum {
+    HIST_AGGIUNGI_RICETTA_NS,  // Latenza per tipo di comando, in nanosecondi
+    HIST_RIMUOVI_RICETTA_NS,
+    HIST_RIFORNIMENTO_NS,
+    HIST_ORDINE_NS,
+    HIST_CORRIERE_NS,
+    HIST_HASH_PROBE_LENGTH,    // Gruppi visitati da una ricerca
+    HIST_ORDERS_PER_RESTOCK,
+    HIST_COURIER_BATCH,        // Ordini caricati da un passaggio del corriere
+    STAT_HISTOGRAMS
+} StatHistogram;
+
+const char *const stat_histogram_names[STAT_HISTOGRAMS] = {
+    "aggiungi_ricetta_ns", "rimuovi_ricetta_ns", "rifornimento_ns", "ordine_ns", "corriere_ns",
+    "hash_probe_length", "orders_per_restock", "courier_batch",
+};
+
+// Istogramma con un bucket per potenza di 2: il bucket b contiene i valori in [2^(b-1), 2^b)
+typedef struct {
+    unsigned long long buckets[65];
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long max;
+} Histogram;
+
+// Ogni thread conta per conto proprio; i thread del lotto sommano i loro dati a quelli del thread principale
+__thread unsigned long long stat_counters[STAT_COUNTERS];
+__thread Histogram stat_histograms[STAT_HISTOGRAMS];
+unsigned long long *stat_main_counters;
+Histogram *stat_main_histograms;
+pthread_mutex_t stat_merge_lock = PTHREAD_MUTEX_INITIALIZER;
+volatile sig_atomic_t stats_dump_requested = 0;
+
+void stat_record(StatHistogram histogram, unsigned long long value) {
+    Histogram *h = &stat_histograms[histogram];
+    h->buckets[value == 0 ? 0 : 64 - __builtin_clzll(value)]++;
+    h->count++;
+    h->sum += value;
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+unsigned long long stat_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Limite superiore del bucket che contiene il percentile p (approssimato per eccesso)
+unsigned long long stat_percentile(const Histogram *h, double p) {
+    unsigned long long rank = (unsigned long long)(p / 100.0 * h->count);
+    unsigned long long seen = 0;
+    for (int b = 0; b < 65; b++) {
+        seen += h->buckets[b];
+        if (seen > rank) {
+            unsigned long long bound = b == 0 ? 0 : (b == 64 ? ~0ULL : (1ULL << b) - 1);
+            return bound < h->max ? bound : h->max;
+        }
+    }
+    return h->max;
+}
+
+void stats_dump(void) {
+    static const double percentiles[] = {50, 90, 99, 99.9};
+    fprintf(stderr, "== statistiche ==\n");
+    for (int i = 0; i < STAT_COUNTERS; i++) {
+        fprintf(stderr, "%-26s %llu\n", stat_counter_names[i], stat_counters[i]);
+    }
+    fprintf(stderr, "%-26s %10s %12s %10s %10s %10s %10s %12s\n", "istogramma", "numero", "media", "p50", "p90", "p99", "p99.9", "max");
+    for (int i = 0; i < STAT_HISTOGRAMS; i++) {
+        const Histogram *h = &stat_histograms[i];
+        fprintf(stderr, "%-26s %10llu %12.1f", stat_histogram_names[i], h->count, h->count ? (double)h->sum / h->count : 0.0);
+        for (int p = 0; p < 4; p++) {
+            fprintf(stderr, " %10llu", stat_percentile(h, percentiles[p]));
+        }
+        fprintf(stderr, " %12llu\n", h->max);
+    }
+
+    // Stessi dati in JSON su una riga, con i bucket non vuoti come coppie [limite superiore, numero]
+    fprintf(stderr, "{\"counters\":{");
+    for (int i = 0; i < STAT_COUNTERS; i++) {
+        fprintf(stderr, "%s\"%s\":%llu", i ? "," : "", stat_counter_names[i], stat_counters[i]);
+    }
+    fprintf(stderr, "},\"histograms\":{");
+    for (int i = 0; i < STAT_HISTOGRAMS; i++) {
+        const Histogram *h = &stat_histograms[i];
+        fprintf(stderr, "%s\"%s\":{\"count\":%llu,\"sum\":%llu,\"max\":%llu,\"buckets\":[",
+                i ? "," : "", stat_histogram_names[i], h->count, h->sum, h->max);
+        bool first = true;
+        for (int b = 0; b < 65; b++) {
+            if (h->buckets[b] != 0) {
+                fprintf(stderr, "%s[%llu,%llu]", first ? "" : ",", b == 0 ? 0 : (b == 64 ? ~0ULL : (1ULL << b) - 1), h->buckets[b]);
+                first = false;
+            }
+        }
+        fprintf(stderr, "]}");
+    }
+    fprintf(stderr, "}}\n");
+}
+
+// Il gestore si limita a segnalare la richiesta: la stampa avviene tra un comando e l'altro
+void stats_signal_handler(int signal_number) {
+    (void)signal_number;
+    stats_dump_requested = 1;
+}
+
+void stats_install(void) {
+    stat_main_counters = stat_counters;
+    stat_main_histograms = stat_histograms;
+    signal(SIGUSR1, stats_signal_handler);
+    atexit(stats_dump);
+}
+
+// Somma i dati del thread corrente a quelli del thread principale (fermo in attesa dei thread del lotto)
+void stats_merge(void) {
+    pthread_mutex_lock(&stat_merge_lock);
+    for (int i = 0; i < STAT_COUNTERS; i++) {
+        stat_main_counters[i] += stat_counters[i];
+    }
+    for (int i = 0; i < STAT_HISTOGRAMS; i++) {
+        Histogram *total = &stat_main_histograms[i];
+        const Histogram *h = &stat_histograms[i];
+        for (int b = 0; b < 65; b++) {
+            total->buckets[b] += h->buckets[b];
+        }
+        total->count += h->count;
+        total->sum += h->sum;
+        if (h->max > total->max) {
+            total->max = h->max;
+        }
+    }
+    pthread_mutex_unlock(&stat_merge_lock);
+}
+
+#define STAT_ADD(counter, amount) (stat_counters[counter] += (amount))
+#define STAT_RECORD(histogram, value) stat_record(histogram, value)
+#define STAT_TIMER(name) unsigned long long name = stat_now_ns()
+#define STAT_TIMER_RECORD(histogram, name) stat_record(histogram, stat_now_ns() - (name))
+#define STAT_POLL() do { if (stats_dump_requested) { stats_dump_requested = 0; stats_dump(); } } while (0)
+#define STAT_INSTALL() stats_install()
+#define STAT_MERGE() stats_merge()
+
+#else
+
+#define STAT_ADD(counter, amount) ((void)0)
+#define STAT_RECORD(histogram, value) ((void)(value))
+#define STAT_TIMER(name) ((void)0)
+#define STAT_TIMER_RECORD(histogram, name) ((void)0)
+#define STAT_POLL() ((void)0)
+#define STAT_INSTALL() ((void)0)
+#define STAT_MERGE() ((void)0)
+
+#endif
 
 // ****____****____****____****____**** FUNZIONI DI BASE ****____****____****____****____****
 
@@ -84,906 +691,3623 @@ unsigned int xor(unsigned int hash, unsigned char value) {
     return hash ^ value;
 }
 
-unsigned int fnv1a_hash(const char *key) {
+unsigned int fnv1a_hash(const char *key, unsigned int length) {
     unsigned int hash = FNV_OFFSET_BASIS;
-    while (*key) {
-        hash = xor(hash, *key); // Chiama la funzione XOR
-        hash *= FNV_PRIME;      // Moltiplica per il primo
-        key++;                  // Avanza alla lettera successiva
+    for (unsigned int i = 0; i < length; i++) {
+        hash = xor(hash, key[i]); // Chiama la funzione XOR
+        hash *= FNV_PRIME;        // Moltiplica per il primo
     }
     return hash;
 }
 
-// Crea un min-heap per i lotti
-MinHeap_lots* create_minheap_lots(int capacity) {
-    MinHeap_lots *minHeap = malloc(sizeof(MinHeap_lots));
-    minHeap->size = 0;
-    minHeap->capacity = capacity;
-    minHeap->lots = (Lot*) malloc(capacity * sizeof(Lot));
-    return minHeap;
+// ****____****____****____****____**** ALLOCATORI ****____****____****____****____****
+
+// Alloca un blocco di almeno size byte e lo aggiunge alla lista chunks, ritorna l'inizio dell'area utile
+char *allocate_chunk(MemoryChunk **chunks, size_t size) {
+    MemoryChunk *chunk = malloc(sizeof(MemoryChunk) + size);
+    chunk->next = *chunks;
+    chunk->size = size;
+    *chunks = chunk;
+    return (char *)(chunk + 1);
 }
 
-// Crea un min-heap per gli ordini pronti
-MinHeap_orders* create_minheap_orders(int capacity) {
-    MinHeap_orders *heap = malloc(sizeof(MinHeap_orders));
-    heap->orders = (OrderNode **)malloc(capacity * sizeof(OrderNode *));
-    heap->size = 0;
-    heap->capacity = capacity;
-    return heap;
+// Libera tutti i blocchi di una lista
+void release_chunks(MemoryChunk **chunks) {
+    while (*chunks != NULL) {
+        MemoryChunk *next = (*chunks)->next;
+        free(*chunks);
+        *chunks = next;
+    }
 }
 
-int string_to_int(const char *str) {
-    int result = 0;
-    while (*str >= '0' && *str <= '9') {
-        result = result * 10 + (*str - '0');
-        str++;
+// Tabella degli ordini vuota: le colonne vengono allocate al primo ordine
+void order_store_init(OrderStore *store) {
+    memset(store, 0, sizeof(OrderStore));
+    store->size = 1;  // Lo slot 0 è NO_ORDER
+}
+
+// Porta le colonne della tabella a capacity ordini
+void order_store_reserve(OrderStore *store, unsigned int capacity) {
+    store->recipe = realloc(store->recipe, capacity * sizeof(unsigned int));
+    store->quantity = realloc(store->quantity, capacity * sizeof(int));
+    store->tick = realloc(store->tick, capacity * sizeof(int));
+    store->next = realloc(store->next, capacity * sizeof(OrderId));
+    store->capacity = capacity;
+}
+
+// Prende un ID dalla free list o, se è vuota, il primo mai usato
+OrderId order_alloc(OrderStore *store) {
+    store->live++;
+    if (store->free_list != NO_ORDER) {
+        OrderId order = store->free_list;
+        store->free_list = store->next[order];
+        return order;
     }
-    return result;
+    if (store->size >= store->capacity) {  // Anche alla prima allocazione, quando size è 1
+        order_store_reserve(store, store->capacity == 0 ? ORDER_STORE_INITIAL_CAPACITY : store->capacity * 2);
+    }
+    return store->size++;
 }
 
-// ****____****____****____****____**** VARIABILI GLOBALI ****____****____****____****____****
+// Restituisce l'ID di un ordine spedito alla tabella
+void order_free(OrderStore *store, OrderId order) {
+    store->next[order] = store->free_list;
+    store->free_list = order;
+    store->live--;
+}
 
-Ingredient *ingredientTable[INGREDIENT_TABLE_SIZE];     // Hash Table per gli ingredienti
-Recipe *recipeTable[RECIPE_TABLE_SIZE];                 // Hash Table per le ricette
-OrderList pending_orders_list = {NULL, NULL};  // Lista degli ordini in attesa
-OrderList orders_to_load = {NULL, NULL};       // Lista degli ordini pronti da ordinare prima di spedizione
-int last_supply_tick = -1;
+// Libera in blocco tutti gli ordini mantenendo le colonne allocate
+void order_store_clear(OrderStore *store) {
+    store->free_list = NO_ORDER;
+    store->size = 1;
+    store->live = 0;
+}
 
-// ****____****____****____****____**** GESTIONE INGREDIENTI ****____****____****____****____****
+// Libera le colonne della tabella
+void order_store_release(OrderStore *store) {
+    free(store->recipe);
+    free(store->quantity);
+    free(store->tick);
+    free(store->next);
+    order_store_init(store);
+}
 
-// Funzione per ridimensionare il Min-Heap dei lotti di un ingrediente
-void resize_minheap(MinHeap_lots *heap) {
-    if (heap->lots == NULL) return;
-    heap->capacity *= 2;  // Raddoppia la capacità
-    Lot *new_lots = (Lot *)realloc(heap->lots, heap->capacity * sizeof(Lot));
-    if (new_lots == NULL) {
-        // Se realloc fallisce, stampa un errore o gestisci il fallimento
-        printf("Errore: impossibile allocare memoria per il MinHeap.\n");
-        return;
+// Classe di dimensione (potenza di 2) che contiene size byte
+int arena_class(size_t size) {
+    if (size <= (1u << ARENA_MIN_CLASS)) {
+        return ARENA_MIN_CLASS;
     }
-    heap->lots = new_lots;
+    return 64 - __builtin_clzll(size - 1);
 }
 
-// Inserisci un lotto in un min-heap (heapify)
-void insert_lot(MinHeap_lots *heap, int quantity, int expiration) {
+// Alloca almeno size byte, riusando un blocco liberato della stessa classe se disponibile
+void *arena_alloc(Arena *arena, size_t size) {
+    int class = arena_class(size);
+    if (arena->free_lists[class] != NULL) {
+        void *block = arena->free_lists[class];
+        arena->free_lists[class] = *(void **)block;
+        return block;
+    }
+    size_t class_size = (size_t)1 << class;
+    if ((size_t)(arena->end - arena->cursor) < class_size) {
+        // Il resto del blocco corrente viene abbandonato fino al prossimo reset
+        size_t chunk_size = class_size > ARENA_CHUNK_SIZE ? class_size : ARENA_CHUNK_SIZE;
+        arena->cursor = allocate_chunk(&arena->chunks, chunk_size);
+        arena->end = arena->cursor + chunk_size;
+        arena->bytes += sizeof(MemoryChunk) + chunk_size;
+    }
+    void *block = arena->cursor;
+    arena->cursor += class_size;
+    return block;
+}
 
-    if (heap->size == heap->capacity) {
-        resize_minheap(heap);  // Ridimensiona il min-heap se pieno
+// Restituisce un blocco di size byte (la stessa dimensione chiesta ad arena_alloc)
+void arena_free(Arena *arena, void *block, size_t size) {
+    if (block == NULL) {
+        return;
     }
-    heap->lots[heap->size].quantity = quantity;
-    heap->lots[heap->size].expiration = expiration;
-    int i = heap->size;
-    heap->size++;
+    int class = arena_class(size);
+    *(void **)block = arena->free_lists[class];
+    arena->free_lists[class] = block;
+}
 
-    // Heapify verso l'alto
-    while (i > 0 && heap->lots[i].expiration < heap->lots[(i - 1) / 2].expiration) {
-        Lot temp = heap->lots[i];
-        heap->lots[i] = heap->lots[(i - 1) / 2];
-        heap->lots[(i - 1) / 2] = temp;
-        i = (i - 1) / 2;
+// Ridimensiona un blocco da old_size a new_size byte, copiandone il contenuto se cambia classe
+void *arena_realloc(Arena *arena, void *block, size_t old_size, size_t new_size) {
+    if (block != NULL && arena_class(old_size) == arena_class(new_size)) {
+        return block;
     }
+    void *new_block = arena_alloc(arena, new_size);
+    if (block != NULL) {
+        memcpy(new_block, block, old_size < new_size ? old_size : new_size);
+        arena_free(arena, block, old_size);
+    }
+    return new_block;
 }
 
-// Funzione heapify verso il basso per rimuovere un ingrediente
-void remove_ingredient_lot(MinHeap_lots *heap) {
-    // Sostituisci il lotto in cima con l'ultimo e riduci la dimensione
-    heap->lots[0] = heap->lots[heap->size - 1];
-    heap->size--;
+// Libera in blocco tutta la memoria dell'arena, che resta utilizzabile
+void arena_reset(Arena *arena) {
+    release_chunks(&arena->chunks);
+    memset(arena, 0, sizeof(Arena));
+}
 
-    // Heapify verso il basso per ripristinare la proprietà del min-heap (solo se heap size > 0)
-    int j = 0;
-    while (j < heap->size) {
-        int left = 2 * j + 1;
-        int right = 2 * j + 2;
-        int smallest = j;
+// Copia il nome di una chiave in una stringa allocata nell'arena
+char *copy_name(Arena *arena, const NameKey *key) {
+    char *name = arena_alloc(arena, key->length + 1);
+    memcpy(name, key->str, key->length);
+    name[key->length] = '\0';
+    return name;
+}
 
-        if (left < heap->size && heap->lots[left].expiration < heap->lots[smallest].expiration) {
-            smallest = left;
-        }
-        if (right < heap->size && heap->lots[right].expiration < heap->lots[smallest].expiration) {
-            smallest = right;
+
+// Alloca buffer e bitmap della coda degli ordini pronti per capacity tick
+void allocate_ready_queue(ReadyQueue *queue, int capacity) {
+    int words = capacity / 64;
+    queue->capacity = capacity;
+    queue->orders = malloc(capacity * sizeof(OrderId));
+    queue->bits = calloc(words, sizeof(unsigned long long));
+    queue->summary = calloc((words + 63) / 64, sizeof(unsigned long long));
+    queue->weight_tree = calloc(capacity + 1, sizeof(long long));
+    queue->count_tree = calloc(capacity + 1, sizeof(int));
+}
+
+// Crea la coda degli ordini pronti
+ReadyQueue* create_ready_queue(void) {
+    ReadyQueue *queue = malloc(sizeof(ReadyQueue));
+    allocate_ready_queue(queue, READY_QUEUE_INITIAL_CAPACITY);
+    queue->size = 0;
+    queue->min_tick = 0;
+    queue->max_tick = 0;
+    queue->total_weight = 0;
+    queue->wide_tick = 0;
+    return queue;
+}
+
+// ****____****____****____****____**** HASH TABLE ****____****____****____****____****
+
+// Maschera dei byte di controllo del gruppo uguali a value
+unsigned int group_match(const unsigned char *group, unsigned char value) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_load_si128((const __m128i *)group);
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)value)));
+#else
+    unsigned int mask = 0;
+    for (int i = 0; i < HASH_GROUP_WIDTH; i++) {
+        mask |= (unsigned int)(group[i] == value) << i;
+    }
+    return mask;
+#endif
+}
+
+// Maschera degli slot del gruppo liberi (vuoti o tombstone): sono quelli col bit alto acceso
+unsigned int group_match_free(const unsigned char *group) {
+#ifdef __SSE2__
+    return (unsigned int)_mm_movemask_epi8(_mm_load_si128((const __m128i *)group));
+#else
+    unsigned int mask = 0;
+    for (int i = 0; i < HASH_GROUP_WIDTH; i++) {
+        mask |= (unsigned int)(group[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
+
+// Confronta il nome di uno slot con la chiave
+bool slot_name_equals(const HashSlot *slot, const NameKey *key) {
+    const char *name = slot->name;
+    if (key->length > MAX_NAME_LENGTH) {
+        if (slot->external.marker != '\0') {
+            return false;
         }
+        name = slot->external.long_name;
+    }
+    return memcmp(name, key->str, key->length) == 0 && name[key->length] == '\0';
+}
 
-        if (smallest != j) {
-            Lot temp = heap->lots[j];
-            heap->lots[j] = heap->lots[smallest];
-            heap->lots[smallest] = temp;
-            j = smallest;
-        } else {
-            break;
+// Cerca lo slot della chiave, ritorna -1 se la chiave non è presente
+int hash_table_find_slot(HashTable *table, const NameKey *key) {
+    if (table->capacity == 0) {
+        return -1;
+    }
+    unsigned int group_mask = table->capacity / HASH_GROUP_WIDTH - 1;
+    unsigned int group = (key->hash >> 7) & group_mask;
+    unsigned char h2 = key->hash & 0x7F;
+    STAT_ADD(STAT_HASH_LOOKUPS, 1);
+
+    // Scansione quadratica sui gruppi fino a un gruppo con uno slot vuoto
+    for (unsigned int step = 1; ; step++) {
+        const unsigned char *ctrl = table->ctrl + group * HASH_GROUP_WIDTH;
+        STAT_ADD(STAT_HASH_GROUPS_PROBED, 1);
+        unsigned int match = group_match(ctrl, h2);
+        while (match != 0) {
+            unsigned int index = group * HASH_GROUP_WIDTH + __builtin_ctz(match);
+            if (table->slots[index].hash == key->hash && slot_name_equals(&table->slots[index], key)) {
+                STAT_RECORD(HIST_HASH_PROBE_LENGTH, step);
+                return (int)index;
+            }
+            match &= match - 1;
+        }
+        if (group_match(ctrl, CTRL_EMPTY) != 0) {
+            STAT_RECORD(HIST_HASH_PROBE_LENGTH, step);
+            return -1;
         }
+        group = (group + step) & group_mask;
     }
 }
 
-// Funzione per cercare un ingrediente all'interno della hash table ingredientTable
-unsigned int search_ingredient(const char *name) {
-    unsigned int hash1 = fnv1a_hash(name) % INGREDIENT_TABLE_SIZE;  // Prima funzione hash (indice iniziale)
-    unsigned int step = hash1 % (INGREDIENT_TABLE_SIZE - 1) + 1;    // Passo incrementale
-    unsigned int index = hash1;  // Indice iniziale
-    unsigned int i = 0;          // Contatore di tentativi
+// Cerca un valore nella hash table, NULL se non presente
+HashValue *hash_table_find(HashTable *table, const NameKey *key) {
+    int index = hash_table_find_slot(table, key);
+    return index >= 0 ? &table->slots[index].value : NULL;
+}
 
-    // Ciclo fino a trovare un bucket vuoto o l'ingrediente cercato
-    while (ingredientTable[index] != NULL) {
-        if (strcmp(ingredientTable[index]->name, name) == 0) {
-            return index;  // Ingrediente trovato
+// Trova il primo slot libero (vuoto o tombstone) nella sequenza di scansione di hash
+unsigned int hash_table_free_slot(const HashTable *table, unsigned int hash) {
+    unsigned int group_mask = table->capacity / HASH_GROUP_WIDTH - 1;
+    unsigned int group = (hash >> 7) & group_mask;
+    for (unsigned int step = 1; ; step++) {
+        unsigned int free_mask = group_match_free(table->ctrl + group * HASH_GROUP_WIDTH);
+        if (free_mask != 0) {
+            return group * HASH_GROUP_WIDTH + __builtin_ctz(free_mask);
         }
-        if (i >= MAX_INGREDIENT_RETRIES) {
-            return INGREDIENT_TABLE_SIZE;  // Troppi tentativi
+        group = (group + step) & group_mask;
+    }
+}
+
+// Capacità, a partire da capacity, che gli elementi riempiono al massimo per metà del carico massimo
+unsigned int hash_table_fitting_capacity(const HashTable *table, unsigned int capacity) {
+    while ((table->size + 1) * 200 > capacity * HASH_TABLE_MAX_LOAD) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+// Ricostruisce la tabella con new_capacity slot, eliminando i tombstone
+void hash_table_rebuild(HashTable *table, unsigned int new_capacity) {
+    STAT_ADD(STAT_HASH_RESIZES, 1);
+    HashTable old = *table;
+    table->ctrl = aligned_alloc(HASH_GROUP_WIDTH, new_capacity);
+    memset(table->ctrl, CTRL_EMPTY, new_capacity);
+    table->slots = malloc(new_capacity * sizeof(HashSlot));
+    table->capacity = new_capacity;
+    table->used = table->size;
+
+    for (unsigned int i = 0; i < old.capacity; i++) {
+        if (old.ctrl[i] < CTRL_EMPTY) {
+            unsigned int index = hash_table_free_slot(table, old.slots[i].hash);
+            table->ctrl[index] = old.ctrl[i];
+            table->slots[index] = old.slots[i];
         }
-        i++;
-        index = (hash1 + i * step) % INGREDIENT_TABLE_SIZE;
     }
+    free(old.ctrl);
+    free(old.slots);
+}
+
+// Ricostruisce la tabella, raddoppiandola se gli elementi la riempiono oltre metà del carico massimo
+void hash_table_rehash(HashTable *table) {
+    hash_table_rebuild(table, hash_table_fitting_capacity(table, table->capacity == 0 ? HASH_TABLE_INITIAL_CAPACITY : table->capacity));
+}
+
+// Dimezza la tabella finché resta entro il carico, dopo molte rimozioni
+void hash_table_shrink(HashTable *table) {
+    unsigned int capacity = hash_table_fitting_capacity(table, HASH_TABLE_INITIAL_CAPACITY);
+    if (table->capacity != 0 && capacity < table->capacity) {
+        STAT_ADD(STAT_SHRINKS, 1);
+        hash_table_rebuild(table, capacity);
+    }
+}
+
+// Inserisce una chiave non presente; stable_name (copia del nome del proprietario) serve solo per i nomi lunghi
+void hash_table_insert(HashTable *table, const NameKey *key, const char *stable_name, HashValue value) {
+    if ((table->used + 1) * 100 > table->capacity * HASH_TABLE_MAX_LOAD) {
+        hash_table_rehash(table);  // Troppi slot occupati: cresce o elimina i tombstone
+    }
+    unsigned int index = hash_table_free_slot(table, key->hash);
+    if (table->ctrl[index] == CTRL_EMPTY) {
+        table->used++;  // Un tombstone riutilizzato era già contato
+    }
+    table->ctrl[index] = key->hash & 0x7F;
+
+    HashSlot *slot = &table->slots[index];
+    if (key->length <= MAX_NAME_LENGTH) {
+        memcpy(slot->name, key->str, key->length);
+        slot->name[key->length] = '\0';
+    } else {
+        slot->external.marker = '\0';
+        slot->external.long_name = stable_name;
+    }
+    slot->hash = key->hash;
+    slot->value = value;
+    table->size++;
+}
 
-    return INGREDIENT_TABLE_SIZE;  // Bucket vuoto, l'ingrediente non c'è nella hash table degli ingredienti
+// Rimuove una chiave; lascia un tombstone solo se qualche scansione può aver superato il gruppo
+void hash_table_remove(HashTable *table, const NameKey *key) {
+    int index = hash_table_find_slot(table, key);
+    if (index < 0) {
+        return;
+    }
+    // Un gruppo con uno slot vuoto interrompe sempre la scansione, quindi lo slot può tornare vuoto
+    if (group_match(table->ctrl + (index & ~(HASH_GROUP_WIDTH - 1)), CTRL_EMPTY) != 0) {
+        table->ctrl[index] = CTRL_EMPTY;
+        table->used--;
+    } else {
+        table->ctrl[index] = CTRL_DELETED;
+    }
+    table->size--;
+}
 
+// Svuota la tabella mantenendone gli array
+void hash_table_clear(HashTable *table) {
+    if (table->capacity != 0) {
+        memset(table->ctrl, CTRL_EMPTY, table->capacity);
+    }
+    table->size = 0;
+    table->used = 0;
 }
 
-// Funzione per aggiungere un ingrediente e il suo lotto
-void add_ingredient(const char *name, int quantity, int expiration) {
+// ****____****____****____****____**** VARIABILI GLOBALI ****____****____****____****____****
+
+Bakery main_bakery;                     // Simulazione del thread principale
+__thread Bakery *bakery = &main_bakery;  // Simulazione su cui lavora il thread corrente
+Journal journal = {NULL, NULL, 0, 0, 0};  // Giornale dei comandi (--giornale)
+size_t memory_limit = 0;  // --max-memory: byte contati per simulazione (0 se senza limite)
+
+// ****____****____****____****____**** FILE BINARI ****____****____****____****____****
+
+bool binary_writer_open(BinaryWriter *writer, const char *path) {
+    writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    writer->failed = writer->fd < 0;
+    writer->size = 0;
+    return !writer->failed;
+}
 
-    unsigned int hash1 = fnv1a_hash(name) % INGREDIENT_TABLE_SIZE;  // Prima funzione hash (indice iniziale)
-    unsigned int step = hash1 % (INGREDIENT_TABLE_SIZE - 1) + 1;    // Passo incrementale
-    unsigned int index = hash1;  // Indice iniziale
-    unsigned int i = 0;          // Contatore di tentativi
+void binary_writer_flush(BinaryWriter *writer) {
+    size_t written = 0;
+    while (!writer->failed && written < writer->size) {
+        ssize_t bytes = write(writer->fd, writer->data + written, writer->size - written);
+        if (bytes < 0 && errno != EINTR) {
+            writer->failed = true;
+        } else if (bytes > 0) {
+            written += bytes;
+        }
+    }
+    writer->size = 0;
+}
 
-    // Finchè non trovi un bucket vuoto o lo stesso ingrediente vai al prossimo bucket
-    while (ingredientTable[index] != NULL && strcmp(ingredientTable[index]->name, name) != 0) {
-        if (i >= MAX_INGREDIENT_RETRIES) {       //se il numero di tentativi il massimo ci rinunciamo
-            // La tabella è piena
+void binary_write(BinaryWriter *writer, const void *bytes, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    if (writer->size + length > OUTPUT_BUFFER_SIZE) {
+        binary_writer_flush(writer);
+        if (length > OUTPUT_BUFFER_SIZE) {
+            ssize_t written = write(writer->fd, bytes, length);
+            writer->failed |= written != (ssize_t)length;
             return;
         }
-        i++;
-        index = (hash1 + i * step) % INGREDIENT_TABLE_SIZE;
-    }
-
-    // Se l'ingrediente non esiste, crealo
-    if (ingredientTable[index] == NULL) {
-        Ingredient *newIngredient = malloc(sizeof(Ingredient));
-        newIngredient->name = malloc(sizeof(char)*(strlen(name)) + 1);
-        strcpy(newIngredient->name, name);
-        newIngredient->heap = create_minheap_lots(10);  // Capacità iniziale del heap
-        newIngredient->total_quantity = quantity;
-        ingredientTable[index] = newIngredient;
-
-        insert_lot(ingredientTable[index]->heap, quantity, expiration);
-    }
-    else {
-        ingredientTable[index]->total_quantity += quantity;
-        MinHeap_lots *heap = ingredientTable[index]->heap;
-        bool found = false;
-        for (i = 0; i < heap->size && heap->lots[i].expiration >= expiration; ++i) {
-            if(heap->lots[i].expiration == expiration) {
-                heap->lots[i].quantity += quantity;
-                found = true;
-                break;
-            }
+    }
+    memcpy(writer->data + writer->size, bytes, length);
+    writer->size += length;
+}
+
+void binary_write_int(BinaryWriter *writer, int value) {
+    binary_write(writer, &value, sizeof(int));
+}
+
+// Scrive un nome come lunghezza seguita dai byte, allineato a 4 byte
+void binary_write_name(BinaryWriter *writer, const char *name, int length) {
+    static const char padding[4] = {0};
+    binary_write_int(writer, length);
+    binary_write(writer, name, length);
+    binary_write(writer, padding, -length & 3);
+}
+
+// Svuota il buffer, porta il file su disco, lo chiude e ritorna true se ogni scrittura è andata a buon fine
+bool binary_writer_close(BinaryWriter *writer) {
+    binary_writer_flush(writer);
+    if (writer->fd >= 0 && fdatasync(writer->fd) != 0) {
+        writer->failed = true;
+    }
+    if (writer->fd >= 0 && close(writer->fd) != 0) {
+        writer->failed = true;
+    }
+    return !writer->failed;
+}
+
+// Mappa in memoria un file intero, false se non è leggibile
+bool binary_reader_open(BinaryReader *reader, const char *path) {
+    reader->data = NULL;
+    reader->size = 0;
+    reader->pos = 0;
+    reader->failed = true;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            reader->data = map;
+            reader->size = info.st_size;
+            reader->failed = false;
         }
-        if (!found) {
-            insert_lot(heap, quantity, expiration);
+    }
+    close(fd);
+    return !reader->failed;
+}
+
+void binary_reader_close(BinaryReader *reader) {
+    if (reader->data != NULL) {
+        munmap((void *)reader->data, reader->size);
+    }
+}
+
+int binary_read_int(BinaryReader *reader) {
+    int value = 0;
+    if (reader->size - reader->pos < sizeof(int)) {
+        reader->failed = true;
+        reader->pos = reader->size;
+        return 0;
+    }
+    memcpy(&value, reader->data + reader->pos, sizeof(int));
+    reader->pos += sizeof(int);
+    return value;
+}
+
+// Legge un nome: la chiave punta direttamente nel file mappato
+void binary_read_name(BinaryReader *reader, NameKey *key) {
+    int length = binary_read_int(reader);
+    size_t padded = ((size_t)length + 3) & ~(size_t)3;
+    if (length < 0 || reader->size - reader->pos < padded) {
+        reader->failed = true;
+        reader->pos = reader->size;
+        length = 0;
+    }
+    key->str = reader->data + reader->pos;
+    key->length = length;
+    key->hash = fnv1a_hash(key->str, length);
+    reader->pos += padded;
+}
+
+// Rende durevoli i record del giornale scritti finora (group commit)
+void journal_sync(void) {
+    if (journal.writer == NULL || journal.pending_records == 0) {
+        return;
+    }
+    binary_writer_flush(journal.writer);
+    if (fdatasync(journal.writer->fd) != 0) {
+        journal.writer->failed = true;
+    }
+    journal.pending_records = 0;
+}
+
+// ****____****____****____****____**** CODE TRA THREAD ****____****____****____****____****
+
+void spsc_init(SpscRing *ring, size_t capacity) {
+    ring->slots = malloc(capacity * sizeof(void *));
+    ring->mask = capacity - 1;
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+void spsc_free(SpscRing *ring) {
+    free(ring->slots);
+}
+
+// Attesa su una coda vuota o piena: qualche giro a vuoto, poi il processore passa agli altri thread
+void spsc_wait(unsigned int *spins) {
+    if (++*spins < SPSC_SPINS) {
+#ifdef __SSE2__
+        _mm_pause();
+#endif
+    } else {
+        sched_yield();
+    }
+}
+
+// Inserisce un elemento, attendendo se la coda è piena
+void spsc_push(SpscRing *ring, void *item) {
+    size_t tail = ring->tail;
+    unsigned int spins = 0;
+    while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) > ring->mask) {
+        spsc_wait(&spins);
+    }
+    ring->slots[tail & ring->mask] = item;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Preleva il prossimo elemento, attendendo se la coda è vuota
+void *spsc_pop(SpscRing *ring) {
+    size_t head = ring->head;
+    unsigned int spins = 0;
+    while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head) {
+        spsc_wait(&spins);
+    }
+    void *item = ring->slots[head & ring->mask];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+void mpsc_init(MpscQueue *queue) {
+    queue->stub.next = NULL;
+    queue->head = &queue->stub;
+    queue->tail = &queue->stub;
+}
+
+// Inserisce un nodo; può essere chiamata da più thread insieme
+void mpsc_push(MpscQueue *queue, MpscNode *node) {
+    node->next = NULL;
+    MpscNode *previous = __atomic_exchange_n(&queue->head, node, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&previous->next, node, __ATOMIC_RELEASE);
+}
+
+// Preleva il nodo più vecchio; NULL se la coda è vuota o un inserimento è ancora a metà
+MpscNode *mpsc_pop(MpscQueue *queue) {
+    MpscNode *tail = queue->tail;
+    MpscNode *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (tail == &queue->stub) {
+        if (next == NULL) {
+            return NULL;
         }
+        queue->tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
     }
+    if (next != NULL) {
+        queue->tail = next;
+        return tail;
+    }
+    if (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    // tail è l'ultimo nodo: lo stub torna in coda perché tail possa essere staccato
+    mpsc_push(queue, &queue->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next != NULL) {
+        queue->tail = next;
+        return tail;
+    }
+    return NULL;
+}
 
+// Sveglia il thread in attesa su un eventfd
+void eventfd_signal(int fd) {
+    unsigned long long one = 1;
+    ssize_t ignored = write(fd, &one, sizeof(one));
+    (void)ignored;
 }
 
-// Rimuovi i lotti scaduti
-void remove_expired_lots(int current_tick) {
-    for (int i = 0; i < INGREDIENT_TABLE_SIZE; i++) {
-        if (ingredientTable[i] != NULL) {
-            MinHeap_lots *heap = ingredientTable[i]->heap;
-            // Rimuovi lotti scaduti dal min-heap
-            while (heap->size > 0 && heap->lots[0].expiration <= current_tick) {
-                ingredientTable[i]->total_quantity -= heap->lots[0].quantity;
-                remove_ingredient_lot(heap);
+// ****____****____****____****____**** SCRITTURA OUTPUT ****____****____****____****____****
+
+void byte_buffer_append(ByteBuffer *buffer, const char *data, size_t size) {
+    if (buffer->size + size > buffer->capacity) {
+        buffer->capacity = buffer->capacity == 0 ? 256 : buffer->capacity;
+        while (buffer->size + size > buffer->capacity) {
+            buffer->capacity *= 2;
+        }
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+// Scrive tutti i byte su fd, ritentando le scritture parziali
+void write_all(int fd, const char *data, size_t size) {
+    size_t written = 0;
+    while (written < size) {
+        ssize_t bytes = write(fd, data + written, size - written);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            break;  // Destinazione chiusa: le risposte restanti vanno perse
         }
+        written += bytes;
     }
 }
 
-// ****____****____****____****____**** GESTIONE RICETTE ****____****____****____****____****
+// Scrive sulla destinazione tutto il contenuto del buffer
+void output_flush(void) {
+    if (bakery->output.discard) {
+        bakery->output.size = 0;
+        return;
+    }
+    if (bakery->output.capture != NULL) {
+        // Il servizio rende durevoli i comandi prima di inviare le risposte accumulate
+        byte_buffer_append(bakery->output.capture, bakery->output.data, bakery->output.size);
+        bakery->output.size = 0;
+        return;
+    }
+    // Una risposta esce solo dopo che il suo comando è sul giornale
+    journal_sync();
+    if (bakery->output.pipeline != NULL) {
+        // Il blocco pieno passa al thread di scrittura, che lo restituirà dopo averlo scritto
+        if (bakery->output.size != 0) {
+            bakery->output.block->size = bakery->output.size;
+            spsc_push(&bakery->output.pipeline->filled, bakery->output.block);
+            bakery->output.block = spsc_pop(&bakery->output.pipeline->free_blocks);
+            bakery->output.data = bakery->output.block->data;
+        }
+    } else {
+        write_all(bakery->output.fd, bakery->output.data, bakery->output.size);
+    }
+    bakery->output.size = 0;
+}
 
-int count_ingredients_recipe(char *str) {
-    int count = 1;
-    while(*str != '\0' && *str != '\n') {
-        if(*str == ' ') {
-            count++;
+void output_string(const char *str, size_t length) {
+    if (bakery->output.size + length > OUTPUT_BUFFER_SIZE) {
+        output_flush();
+        // Stringa più grande del buffer: viene scritta a pezzi
+        while (length > OUTPUT_BUFFER_SIZE) {
+            memcpy(bakery->output.data, str, OUTPUT_BUFFER_SIZE);
+            bakery->output.size = OUTPUT_BUFFER_SIZE;
+            output_flush();
+            str += OUTPUT_BUFFER_SIZE;
+            length -= OUTPUT_BUFFER_SIZE;
         }
-        str++;
     }
-    return count/2;
+    memcpy(bakery->output.data + bakery->output.size, str, length);
+    bakery->output.size += length;
 }
 
-// Crea una ricetta con nome e ingredienti
-void add_recipe(const char *recipe_name, char *rest_of_line) {
-    unsigned int hash1 = fnv1a_hash(recipe_name) % RECIPE_TABLE_SIZE;  // Prima funzione hash (indice iniziale)
-    unsigned int step = hash1 % (RECIPE_TABLE_SIZE - 1) + 1;           // Passo incrementale
-    unsigned int index = hash1;  // Indice iniziale
-    unsigned int i = 0;          // Contatore di tentativi
-
-    while (recipeTable[index] != NULL && strcmp(recipeTable[index]->name, recipe_name) != 0) {
-        if (i >= MAX_RECIPE_RETRIES) {
-            // La tabella è piena
-            return;
+// Scrive una stringa terminata da '\0' (le risposte fisse: "accettato\n", "rifornito\n", ...)
+void output_text(const char *str) {
+    output_string(str, strlen(str));
+}
+
+void output_char(char c) {
+    if (bakery->output.size == OUTPUT_BUFFER_SIZE) {
+        output_flush();
+    }
+    bakery->output.data[bakery->output.size++] = c;
+}
+
+// Scrive un intero in base 10 senza passare da printf
+void output_long(long long value) {
+    char digits[21];
+    int i = sizeof(digits);
+    unsigned long long magnitude = value < 0 ? -(unsigned long long)value : (unsigned long long)value;
+    do {
+        digits[--i] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0) {
+        digits[--i] = '-';
+    }
+    output_string(digits + i, sizeof(digits) - i);
+}
+
+void output_int(int value) {
+    output_long(value);
+}
+
+// Scrive un messaggio di errore su stderr, fuori dal flusso delle risposte
+void report_error(const char *message) {
+    ssize_t ignored = write(STDERR_FILENO, message, strlen(message));
+    (void)ignored;
+}
+
+// ****____****____****____****____**** GESTIONE INGREDIENTI ****____****____****____****____****
+
+// Calendario vuoto che usa i lotti inline
+void init_lot_calendar(LotCalendar *calendar) {
+    calendar->lots = calendar->inline_lots;
+    calendar->head = 0;
+    calendar->size = 0;
+    calendar->capacity = LOT_INLINE_CAPACITY;
+}
+
+// Libera un posto in fondo al calendario: compatta i lotti verso l'inizio o raddoppia l'array,
+// spostandoli nell'arena quando non stanno più inline
+void make_room_lot_calendar(LotCalendar *calendar) {
+    STAT_ADD(STAT_LOT_RESIZES, 1);
+    if (calendar->head < calendar->capacity / 2) {
+        if (calendar->lots == calendar->inline_lots) {
+            calendar->lots = arena_alloc(&bakery->lot_arena, 8 * sizeof(Lot));
+            memcpy(calendar->lots, calendar->inline_lots, calendar->size * sizeof(Lot));
+            calendar->capacity = 8;
+        } else {
+            int capacity = calendar->capacity * 2;
+            calendar->lots = arena_realloc(&bakery->lot_arena, calendar->lots, calendar->capacity * sizeof(Lot), capacity * sizeof(Lot));
+            calendar->capacity = capacity;
+        }
+    }
+    if (calendar->head > 0) {
+        memmove(calendar->lots, calendar->lots + calendar->head, (calendar->size - calendar->head) * sizeof(Lot));
+        calendar->size -= calendar->head;
+        calendar->head = 0;
+    }
+}
+
+// Sposta i lotti validi all'inizio di un array di capacity posti nell'arena arena, oppure inline se
+// capacity è LOT_INLINE_CAPACITY. L'array precedente (non inline) torna a free_arena, se non è NULL
+void move_lot_calendar(LotCalendar *calendar, Arena *arena, Arena *free_arena, int capacity) {
+    Lot *lots = capacity == LOT_INLINE_CAPACITY ? calendar->inline_lots : arena_alloc(arena, capacity * sizeof(Lot));
+    int size = calendar->size - calendar->head;
+    memmove(lots, calendar->lots + calendar->head, size * sizeof(Lot));
+    if (free_arena != NULL) {
+        arena_free(free_arena, calendar->lots, calendar->capacity * sizeof(Lot));
+    }
+    calendar->lots = lots;
+    calendar->head = 0;
+    calendar->size = size;
+    calendar->capacity = capacity;
+}
+
+// Dimezza l'array dei lotti di un calendario occupato per meno di un quarto. Gli array da 8 lotti restano:
+// tornare inline a ogni svuotamento farebbe alternare spostamenti fuori e dentro (lo fa compact_memory)
+void shrink_lot_calendar(LotCalendar *calendar) {
+    if (calendar->capacity <= 8 || (calendar->size - calendar->head) * 4 > calendar->capacity) {
+        return;
+    }
+    STAT_ADD(STAT_SHRINKS, 1);
+    move_lot_calendar(calendar, &bakery->lot_arena, &bakery->lot_arena, calendar->capacity / 2);
+}
+
+// Aggiunge quantity unità con scadenza expiration, ritorna true se la scadenza è nuova
+bool insert_lot(LotCalendar *calendar, int quantity, int expiration) {
+    Lot *lots = calendar->lots;
+    // Caso comune: il lotto scade dopo tutti gli altri o insieme all'ultimo, O(1)
+    if (calendar->head == calendar->size || lots[calendar->size - 1].expiration < expiration) {
+        if (calendar->size == calendar->capacity) {
+            make_room_lot_calendar(calendar);
+        }
+        calendar->lots[calendar->size].quantity = quantity;
+        calendar->lots[calendar->size].expiration = expiration;
+        calendar->size++;
+        return true;
+    }
+    if (lots[calendar->size - 1].expiration == expiration) {
+        lots[calendar->size - 1].quantity += quantity;
+        return false;
+    }
+
+    // Ricerca binaria del primo lotto che non scade prima di expiration
+    int low = calendar->head, high = calendar->size - 1;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (lots[middle].expiration < expiration) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (lots[low].expiration == expiration) {
+        lots[low].quantity += quantity;
+        return false;
+    }
+
+    // Inserimento in mezzo: sposta la parte più corta del calendario
+    if (calendar->head > 0 && low - calendar->head < calendar->size - low) {
+        memmove(lots + calendar->head - 1, lots + calendar->head, (low - calendar->head) * sizeof(Lot));
+        calendar->head--;
+        low--;
+    } else {
+        if (calendar->size == calendar->capacity) {
+            int offset = low - calendar->head;
+            make_room_lot_calendar(calendar);
+            lots = calendar->lots;
+            low = calendar->head + offset;
+        }
+        memmove(lots + low + 1, lots + low, (calendar->size - low) * sizeof(Lot));
+        calendar->size++;
+    }
+    lots[low].quantity = quantity;
+    lots[low].expiration = expiration;
+    return true;
+}
+
+// Preleva quantity unità dai lotti più vicini alla scadenza (il totale deve essere disponibile)
+void consume_lots(LotCalendar *calendar, int quantity) {
+    while (quantity > 0) {
+        Lot *lot = &calendar->lots[calendar->head];
+        if (lot->quantity > quantity) {
+            lot->quantity -= quantity;
+            break;
+        }
+        quantity -= lot->quantity;  // Lotto esaurito
+        calendar->head++;
+        STAT_ADD(STAT_LOTS_CONSUMED, 1);
+    }
+    if (calendar->head == calendar->size) {
+        calendar->head = calendar->size = 0;
+    }
+    shrink_lot_calendar(calendar);
+}
+
+// Scarta in blocco i lotti scaduti entro current_tick, ritorna la quantità eliminata
+int expire_lots(LotCalendar *calendar, int current_tick) {
+    int expired = 0;
+    while (calendar->head < calendar->size && calendar->lots[calendar->head].expiration <= current_tick) {
+        expired += calendar->lots[calendar->head].quantity;
+        calendar->head++;
+        STAT_ADD(STAT_LOTS_EXPIRED, 1);
+    }
+    if (calendar->head == calendar->size) {
+        calendar->head = calendar->size = 0;
+    }
+    if (expired > 0) {
+        shrink_lot_calendar(calendar);
+    }
+    return expired;
+}
+
+// Inserisce nella coda delle scadenze l'evento dell'ingrediente, se anticipa quello già presente
+void schedule_expiration(int id, int expiration) {
+    Ingredient *ingredient = &bakery->ingredient_by_id[id];
+    if (expiration >= ingredient->scheduled_expiration) {
+        return;
+    }
+    ingredient->scheduled_expiration = expiration;
+
+    MinHeap_expirations *queue = &bakery->expiration_queue;
+    if (queue->size == queue->capacity) {
+        queue->capacity = queue->capacity == 0 ? 64 : queue->capacity * 2;
+        queue->events = realloc(queue->events, queue->capacity * sizeof(Expiration));
+    }
+    // Heapify verso l'alto
+    int i = queue->size++;
+    queue->events[i].expiration = expiration;
+    queue->events[i].ingredient = id;
+    while (i > 0 && queue->events[i].expiration < queue->events[(i - 1) / 2].expiration) {
+        Expiration temp = queue->events[i];
+        queue->events[i] = queue->events[(i - 1) / 2];
+        queue->events[(i - 1) / 2] = temp;
+        i = (i - 1) / 2;
+    }
+}
+
+// Rimuove l'evento con la scadenza più vicina dalla coda delle scadenze
+void remove_expiration(MinHeap_expirations *queue) {
+    queue->events[0] = queue->events[--queue->size];
+    int j = 0;
+    while (true) {
+        int smallest = j;
+        int left = 2 * j + 1;
+        int right = 2 * j + 2;
+        if (left < queue->size && queue->events[left].expiration < queue->events[smallest].expiration) {
+            smallest = left;
+        }
+        if (right < queue->size && queue->events[right].expiration < queue->events[smallest].expiration) {
+            smallest = right;
+        }
+        if (smallest == j) {
+            return;
+        }
+        Expiration temp = queue->events[j];
+        queue->events[j] = queue->events[smallest];
+        queue->events[smallest] = temp;
+        j = smallest;
+    }
+}
+
+// Elimina i lotti scaduti di un solo ingrediente
+void expire_ingredient_lots(Ingredient *ingredient, int current_tick) {
+    int expired = expire_lots(&ingredient->lots, current_tick);
+    if (expired > 0) {
+        bakery->ingredient_stock[ingredient - bakery->ingredient_by_id] -= expired;
+        bakery->stock_epoch++;
+    }
+}
+
+// Porta gli array degli ingredienti a capacity elementi. Gli ingredienti sono allineati alla riga di cache,
+// quindi non si può usare realloc; i calendari che usano i lotti inline vanno ricollegati alla nuova copia
+void grow_ingredients(int capacity) {
+    Ingredient *ingredients = aligned_alloc(CACHE_LINE_SIZE, capacity * sizeof(Ingredient));
+    for (int id = 0; id < bakery->ingredient_count; id++) {
+        ingredients[id] = bakery->ingredient_by_id[id];
+        if (bakery->ingredient_by_id[id].lots.lots == bakery->ingredient_by_id[id].lots.inline_lots) {
+            ingredients[id].lots.lots = ingredients[id].lots.inline_lots;
+        }
+    }
+    free(bakery->ingredient_by_id);
+    bakery->ingredient_by_id = ingredients;
+    bakery->ingredient_stock = realloc(bakery->ingredient_stock, capacity * sizeof(int));
+    bakery->ingredient_capacity = capacity;
+}
+
+// Cerca l'ID di un ingrediente e, se non esiste, lo crea senza lotti
+int find_or_create_ingredient(const NameKey *key) {
+    HashValue *value = hash_table_find(&bakery->ingredient_table, key);
+    if (value != NULL) {
+        return value->id;
+    }
+
+    // L'ingrediente non esiste: crealo con quantità nulla e il primo ID libero
+    if (bakery->ingredient_count == bakery->ingredient_capacity) {
+        grow_ingredients(bakery->ingredient_capacity == 0 ? 64 : bakery->ingredient_capacity * 2);
+    }
+    int id = bakery->ingredient_count++;
+    Ingredient *ingredient = &bakery->ingredient_by_id[id];
+    bakery->ingredient_stock[id] = 0;
+    ingredient->name = copy_name(&bakery->catalog_arena, key);
+    init_lot_calendar(&ingredient->lots);
+    ingredient->scheduled_expiration = INT_MAX;
+    ingredient->waiting = NULL;
+    ingredient->waiting_size = 0;
+    ingredient->waiting_capacity = 0;
+
+    HashValue new_value;
+    new_value.id = id;
+    hash_table_insert(&bakery->ingredient_table, key, ingredient->name, new_value);
+    return id;
+}
+
+// Funzione per aggiungere un ingrediente e il suo lotto, ritorna l'ID dell'ingrediente rifornito
+int add_ingredient(const NameKey *key, int quantity, int expiration) {
+
+    int id = find_or_create_ingredient(key);
+    Ingredient *ingredient = &bakery->ingredient_by_id[id];
+    bakery->ingredient_stock[id] += quantity;
+    bakery->stock_epoch++;
+    if (insert_lot(&ingredient->lots, quantity, expiration)) {
+        schedule_expiration(id, expiration);
+    }
+    return id;
+}
+
+// Registra la ricetta, che ha appena ricevuto il primo ordine in attesa, presso i suoi ingredienti
+void register_waiting_recipe(Recipe *recipe) {
+    for (int i = 0; i < recipe->ingredients_size; i++) {
+        Ingredient *ingredient = &bakery->ingredient_by_id[recipe->ingredient_ids[i]];
+        if (ingredient->waiting_size == ingredient->waiting_capacity) {
+            int capacity = ingredient->waiting_capacity == 0 ? 4 : ingredient->waiting_capacity * 2;
+            ingredient->waiting = arena_realloc(&bakery->catalog_arena, ingredient->waiting,
+                                                ingredient->waiting_capacity * sizeof(WaitingRecipe),
+                                                capacity * sizeof(WaitingRecipe));
+            ingredient->waiting_capacity = capacity;
+        }
+        ingredient->waiting[ingredient->waiting_size].recipe = recipe;
+        ingredient->waiting[ingredient->waiting_size].slot = i;
+        recipe->waiting_positions[i] = ingredient->waiting_size;
+        ingredient->waiting_size++;
+    }
+}
+
+// Toglie la ricetta, che non ha più ordini in attesa, dagli indici dei suoi ingredienti
+void unregister_waiting_recipe(Recipe *recipe) {
+    for (int i = 0; i < recipe->ingredients_size; i++) {
+        int pos = recipe->waiting_positions[i];
+        if (pos < 0) {
+            continue;
+        }
+        Ingredient *ingredient = &bakery->ingredient_by_id[recipe->ingredient_ids[i]];
+        // Sposta l'ultima ricetta nel posto lasciato libero e aggiorna la sua posizione
+        WaitingRecipe last = ingredient->waiting[--ingredient->waiting_size];
+        ingredient->waiting[pos] = last;
+        last.recipe->waiting_positions[last.slot] = pos;
+        recipe->waiting_positions[i] = -1;
+    }
+}
+
+// Rimuovi i lotti scaduti, visitando solo gli ingredienti con un evento di scadenza passato
+void remove_expired_lots(int current_tick) {
+    MinHeap_expirations *queue = &bakery->expiration_queue;
+    while (queue->size > 0 && queue->events[0].expiration <= current_tick) {
+        Expiration event = queue->events[0];
+        remove_expiration(queue);
+        STAT_ADD(STAT_EXPIRY_EVENTS, 1);
+        Ingredient *ingredient = &bakery->ingredient_by_id[event.ingredient];
+        if (event.expiration != ingredient->scheduled_expiration) {
+            continue;  // Evento superato da uno più recente dello stesso ingrediente
+        }
+        expire_ingredient_lots(ingredient, current_tick);
+
+        // Riprogramma l'ingrediente sulla sua nuova scadenza più vicina
+        ingredient->scheduled_expiration = INT_MAX;
+        if (ingredient->lots.head < ingredient->lots.size) {
+            schedule_expiration(event.ingredient, ingredient->lots.lots[ingredient->lots.head].expiration);
+        }
+    }
+}
+
+// ****____****____****____****____**** GESTIONE RICETTE ****____****____****____****____****
+
+// Cerca una ricetta per nome, NULL se non è nel catalogo
+Recipe *find_recipe(const NameKey *recipe_key) {
+    HashValue *value = hash_table_find(&bakery->recipe_table, recipe_key);
+    return value != NULL ? value->pointer : NULL;
+}
+
+// Numero di elementi degli array degli ingredienti di una ricetta con count ingredienti
+int recipe_lanes(int count) {
+    return (count + REQUIREMENT_LANES - 1) & ~(REQUIREMENT_LANES - 1);
+}
+
+// Assegna alla ricetta un ID libero, riusando quelli delle ricette rimosse
+int assign_recipe_id(Recipe *recipe) {
+    int id;
+    if (bakery->free_recipe_count > 0) {
+        id = bakery->free_recipe_ids[--bakery->free_recipe_count];
+    } else {
+        if (bakery->recipe_count == bakery->recipe_capacity) {
+            bakery->recipe_capacity = bakery->recipe_capacity == 0 ? 64 : bakery->recipe_capacity * 2;
+            bakery->recipe_by_id = realloc(bakery->recipe_by_id, bakery->recipe_capacity * sizeof(Recipe *));
+            bakery->free_recipe_ids = realloc(bakery->free_recipe_ids, bakery->recipe_capacity * sizeof(int));
+        }
+        id = bakery->recipe_count++;
+    }
+    bakery->recipe_by_id[id] = recipe;
+    return id;
+}
+
+// Crea una ricetta vuota con spazio per count ingredienti e la inserisce nel catalogo
+Recipe *create_recipe(const NameKey *recipe_key, int count) {
+    // Un solo blocco per i tre array paralleli
+    int lanes = recipe_lanes(count);
+    int *ids = arena_alloc(&bakery->catalog_arena, 3 * lanes * sizeof(int));
+    int *quantities = ids + lanes;
+    int *waiting_positions = quantities + lanes;
+    for (int i = 0; i < lanes; i++) {
+        quantities[i] = 0;  // Il riempimento richiede 0 unità: è sempre disponibile
+        waiting_positions[i] = -1;
+    }
+
+    Recipe *newRecipe = arena_alloc(&bakery->catalog_arena, sizeof(Recipe));
+    newRecipe->name = copy_name(&bakery->catalog_arena, recipe_key);
+    newRecipe->weight = 0;
+    newRecipe->ingredient_ids = ids;
+    newRecipe->ingredient_quantities = quantities;
+    newRecipe->waiting_positions = waiting_positions;
+    newRecipe->last_quantity_failed = 0;
+    newRecipe->last_tick_check = INT_MIN;  // Prima di ogni rifornimento, anche del -1 iniziale: il primo ordine va controllato
+    newRecipe->ingredients_size = count;
+    newRecipe->id = assign_recipe_id(newRecipe);
+    newRecipe->pending_orders.head = NO_ORDER;
+    newRecipe->pending_orders.tail = NO_ORDER;
+    newRecipe->cursor = NO_ORDER;
+    newRecipe->candidate_tick = -1;
+    newRecipe->outstanding_orders = 0;
+    newRecipe->waiting_orders = 0;
+    newRecipe->max_makeable_epoch = 0;
+    HashValue value;
+    value.pointer = newRecipe;
+    hash_table_insert(&bakery->recipe_table, recipe_key, newRecipe->name, value);
+    return newRecipe;
+}
+
+// Imposta l'i-esimo ingrediente della ricetta e ne aggiorna il peso
+void set_recipe_ingredient(Recipe *recipe, int i, int id, int quantity) {
+    recipe->ingredient_ids[i] = id;
+    recipe->ingredient_quantities[i] = quantity;
+    recipe->weight += quantity;
+    if (i == 0) {
+        // Il riempimento punta al primo ingrediente, che esiste sempre
+        for (int j = recipe->ingredients_size; j < recipe_lanes(recipe->ingredients_size); j++) {
+            recipe->ingredient_ids[j] = id;
+        }
+    }
+}
+
+// Crea una ricetta con nome e ingredienti
+void add_recipe(const NameKey *recipe_key, const CommandItem *items, int count) {
+    // Se la ricetta non esiste, creala
+    if (find_recipe(recipe_key) == NULL) {
+        Recipe *recipe = create_recipe(recipe_key, count);
+        // Copia ingredienti e quantità già letti dalla riga (l'ingrediente viene creato vuoto se non esiste)
+        for(int i = 0; i < count; i++) {
+            set_recipe_ingredient(recipe, i, find_or_create_ingredient(&items[i].name), items[i].quantity);
+        }
+        output_text("aggiunta\n");
+    } else {
+        output_text("ignorato\n");
+    }
+}
+
+// Funzione per rimuovere una ricetta
+void remove_recipe(const NameKey *recipe_key) {
+    Recipe *recipe = find_recipe(recipe_key);
+    if (recipe == NULL) {
+        output_text("non presente\n");
+        return;
+    }
+
+    // Verifica se ci sono ordini in attesa o pronti per questa ricetta
+    if (recipe->outstanding_orders > 0) {
+        output_text("ordini in sospeso\n");
+        return;
+    }
+
+    // Non ci sono ordini in sospeso, possiamo rimuovere la ricetta
+    // Libera array degli ingredienti
+    arena_free(&bakery->catalog_arena, recipe->ingredient_ids, 3 * recipe_lanes(recipe->ingredients_size) * sizeof(int));
+
+    // Rimuovi la ricetta dalla hash table (tombstone solo se il gruppo dello slot è pieno) e liberala insieme al suo ID
+    hash_table_remove(&bakery->recipe_table, recipe_key);
+    bakery->recipe_by_id[recipe->id] = NULL;
+    bakery->free_recipe_ids[bakery->free_recipe_count++] = recipe->id;
+    arena_free(&bakery->catalog_arena, recipe->name, recipe_key->length + 1);
+    arena_free(&bakery->catalog_arena, recipe, sizeof(Recipe));
+    output_text("rimossa\n");
+}
+
+// ****____****____****____****____**** GESTIONE ORDINI DA CARICARE ****____****____****____****____****
+
+// Ricetta di un ordine
+Recipe *order_recipe(OrderId order) {
+    return bakery->recipe_by_id[bakery->orders.recipe[order]];
+}
+
+int order_weight(OrderId order) {
+    return bakery->orders.quantity[order] * order_recipe(order)->weight;
+}
+
+// Aggiunge peso e numero di ordini allo slot position negli alberi di Fenwick
+void ready_tree_add(ReadyQueue *queue, int position, long long weight, int count) {
+    for (int i = position + 1; i <= queue->capacity; i += i & -i) {
+        queue->weight_tree[i] += weight;
+        queue->count_tree[i] += count;
+    }
+}
+
+// Ricostruisce gli alberi in O(capacity) dagli ordini presenti
+void ready_tree_build(ReadyQueue *queue) {
+    memset(queue->weight_tree, 0, (queue->capacity + 1) * sizeof(long long));
+    memset(queue->count_tree, 0, (queue->capacity + 1) * sizeof(int));
+    for (int word = 0; word < queue->capacity / 64; word++) {
+        for (unsigned long long mask = queue->bits[word]; mask != 0; mask &= mask - 1) {
+            int position = word * 64 + __builtin_ctzll(mask);
+            queue->weight_tree[position + 1] = order_weight(queue->orders[position]);
+            queue->count_tree[position + 1] = 1;
+        }
+    }
+    for (int i = 1; i <= queue->capacity; i++) {
+        int parent = i + (i & -i);
+        if (parent <= queue->capacity) {
+            queue->weight_tree[parent] += queue->weight_tree[i];
+            queue->count_tree[parent] += queue->count_tree[i];
+        }
+    }
+}
+
+// Slot [0, end) più lungo con peso al massimo limit; ne restituisce peso e numero di ordini
+int ready_tree_search(const ReadyQueue *queue, long long limit, long long *weight, int *count) {
+    int end = 0;
+    *weight = 0;
+    *count = 0;
+    for (int step = queue->capacity; step > 0; step >>= 1) {
+        if (end + step <= queue->capacity && *weight + queue->weight_tree[end + step] <= limit) {
+            end += step;
+            *weight += queue->weight_tree[end];
+            *count += queue->count_tree[end];
+        }
+    }
+    return end;
+}
+
+// Ordini e peso che il corriere caricherebbe ora: gli ordini dal più vecchio finché il successivo
+// non entra, cioè il prefisso circolare più lungo a partire da min_tick che sta nella capienza. O(log n)
+void ready_queue_courier_preview(const ReadyQueue *queue, int courier_capacity, int *orders, long long *weight) {
+    *orders = 0;
+    *weight = 0;
+    if (queue->size == 0) {
+        return;
+    }
+    // Gli slot prima di start contengono gli ordini più recenti, arrivati dopo il giro del buffer
+    int start = queue->min_tick & (queue->capacity - 1);
+    long long before_weight = 0;
+    int before_count = 0;
+    for (int i = start; i > 0; i -= i & -i) {
+        before_weight += queue->weight_tree[i];
+        before_count += queue->count_tree[i];
+    }
+    long long prefix_weight;
+    int prefix_count;
+    int end = ready_tree_search(queue, before_weight + courier_capacity, &prefix_weight, &prefix_count);
+    *orders = prefix_count - before_count;
+    *weight = prefix_weight - before_weight;
+    if (end == queue->capacity) {
+        // Entrano tutti gli ordini fino alla fine del buffer: si prosegue dall'inizio
+        long long wrapped_weight;
+        int wrapped_count;
+        if (ready_tree_search(queue, courier_capacity - *weight, &wrapped_weight, &wrapped_count) >= start) {
+            wrapped_weight = before_weight;
+            wrapped_count = before_count;
+        }
+        *orders += wrapped_count;
+        *weight += wrapped_weight;
+    }
+}
+
+// Segna come occupato lo slot position della coda
+void ready_queue_set(ReadyQueue *queue, int position, OrderId order) {
+    int word = position >> 6;
+    queue->orders[position] = order;
+    queue->bits[word] |= 1ULL << (position & 63);
+    queue->summary[word >> 6] |= 1ULL << (word & 63);
+}
+
+// Prima parola non nulla di bits a partire da word, proseguendo in modo circolare
+int ready_queue_next_word(const ReadyQueue *queue, int word) {
+    int words = queue->capacity / 64;
+    int summary_words = (words + 63) / 64;
+    if (word == words) {
+        word = 0;
+    }
+    int index = word >> 6;
+    unsigned long long mask = queue->summary[index] & (~0ULL << (word & 63));
+    while (mask == 0) {
+        index = index + 1 == summary_words ? 0 : index + 1;
+        mask = queue->summary[index];
+    }
+    return index * 64 + __builtin_ctzll(mask);
+}
+
+// Ricolloca gli ordini in un buffer di capacity slot (deve superare max_tick - min_tick)
+void relocate_ready_queue(ReadyQueue *queue, int capacity) {
+    STAT_ADD(STAT_READY_QUEUE_RESIZES, 1);
+    ReadyQueue old = *queue;
+    allocate_ready_queue(queue, capacity);
+    for (int word = 0; word < old.capacity / 64; word++) {
+        unsigned long long mask = old.bits[word];
+        while (mask != 0) {
+            OrderId order = old.orders[word * 64 + __builtin_ctzll(mask)];
+            ready_queue_set(queue, bakery->orders.tick[order] & (capacity - 1), order);
+            mask &= mask - 1;
+        }
+    }
+    ready_tree_build(queue);
+    free(old.orders);
+    free(old.bits);
+    free(old.summary);
+    free(old.weight_tree);
+    free(old.count_tree);
+}
+
+// Raddoppia il buffer finché copre tutti i tick da from_tick a to_tick
+void grow_ready_queue(ReadyQueue *queue, int from_tick, int to_tick) {
+    int capacity = queue->capacity;
+    while (to_tick - from_tick >= capacity) {
+        capacity *= 2;
+    }
+    relocate_ready_queue(queue, capacity);
+    queue->wide_tick = -1;
+}
+
+// Capacità minima per i tick presenti nella coda, con margine per gli ordini dei prossimi tick
+int ready_queue_needed_capacity(const ReadyQueue *queue) {
+    int span = queue->size == 0 ? 0 : queue->max_tick - queue->min_tick + 1;
+    int capacity = READY_QUEUE_INITIAL_CAPACITY;
+    while (capacity < 2 * span) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+// Al passaggio del corriere nel tick indicato: riduce il buffer se da almeno capacity tick i tick presenti
+// ne coprono meno di un quarto. L'attesa ripaga la ricollocazione e impedisce di alternare crescita e riduzione
+void shrink_ready_queue(ReadyQueue *queue, int tick) {
+    int capacity = ready_queue_needed_capacity(queue);
+    if (capacity * 2 > queue->capacity || queue->wide_tick < 0) {
+        queue->wide_tick = tick;
+    } else if (tick - queue->wide_tick >= queue->capacity) {
+        STAT_ADD(STAT_SHRINKS, 1);
+        relocate_ready_queue(queue, capacity);
+        queue->wide_tick = tick;
+    }
+}
+
+// Inserisci un ordine pronto nello slot del suo tick di arrivo, O(1) salvo ridimensionamenti
+void insert_ready_order(ReadyQueue *queue, OrderId order) {
+    int tick = bakery->orders.tick[order];
+    if (queue->size == 0) {
+        queue->min_tick = queue->max_tick = tick;
+    } else {
+        int from_tick = tick < queue->min_tick ? tick : queue->min_tick;
+        int to_tick = tick > queue->max_tick ? tick : queue->max_tick;
+        if (to_tick - from_tick >= queue->capacity) {
+            grow_ready_queue(queue, from_tick, to_tick);
+        }
+        queue->min_tick = from_tick;
+        queue->max_tick = to_tick;
+    }
+    ready_queue_set(queue, tick & (queue->capacity - 1), order);
+    int weight = order_weight(order);
+    ready_tree_add(queue, tick & (queue->capacity - 1), weight, 1);
+    queue->total_weight += weight;
+    queue->size++;
+}
+
+// Ordine pronto più vecchio (la coda non deve essere vuota)
+OrderId ready_queue_min(const ReadyQueue *queue) {
+    return queue->orders[queue->min_tick & (queue->capacity - 1)];
+}
+
+// Rimuove l'ordine più vecchio e cerca il successivo scorrendo la bitmap
+void remove_min_ready_order(ReadyQueue *queue) {
+    int mask = queue->capacity - 1;
+    int position = queue->min_tick & mask;
+    int word = position >> 6;
+    int weight = order_weight(queue->orders[position]);
+    ready_tree_add(queue, position, -weight, -1);
+    queue->total_weight -= weight;
+    queue->bits[word] &= ~(1ULL << (position & 63));
+    if (queue->bits[word] == 0) {
+        queue->summary[word >> 6] &= ~(1ULL << (word & 63));
+    }
+    if (--queue->size == 0) {
+        return;
+    }
+
+    // Il prossimo slot occupato in senso circolare è il nuovo minimo
+    unsigned long long rest = queue->bits[word] & (~0ULL << (position & 63));
+    int next;
+    if (rest != 0) {
+        next = word * 64 + __builtin_ctzll(rest);
+    } else {
+        int next_word = ready_queue_next_word(queue, word + 1);
+        next = next_word * 64 + __builtin_ctzll(queue->bits[next_word]);
+    }
+    queue->min_tick += (next - position) & mask;
+}
+
+// Libera la coda (gli ordini che contiene ancora restano nella tabella degli ordini)
+void free_ready_queue(ReadyQueue *queue) {
+    free(queue->orders);
+    free(queue->bits);
+    free(queue->summary);
+    free(queue->weight_tree);
+    free(queue->count_tree);
+    free(queue);
+}
+
+// Svuota la coda mantenendone la capacità (gli ordini vengono rilasciati con la tabella degli ordini)
+void reset_ready_queue(ReadyQueue *queue) {
+    int words = queue->capacity / 64;
+    memset(queue->bits, 0, words * sizeof(unsigned long long));
+    memset(queue->summary, 0, (words + 63) / 64 * sizeof(unsigned long long));
+    memset(queue->weight_tree, 0, (queue->capacity + 1) * sizeof(long long));
+    memset(queue->count_tree, 0, (queue->capacity + 1) * sizeof(int));
+    queue->total_weight = 0;
+    queue->size = 0;
+    queue->min_tick = 0;
+    queue->max_tick = 0;
+    queue->wide_tick = 0;
+}
+
+// Sceglie gli ordini da caricare e li sposta dalla coda degli ordini pronti all'array orders_to_load, in ordine di arrivo
+void choose_orders_to_load(int courier_capacity, ReadyQueue *ready_orders) {
+    int remaining_capacity = courier_capacity;
+    CourierBatch *batch = &bakery->orders_to_load;
+    batch->size = 0;
+
+    if(ready_orders != NULL){
+        while (ready_orders->size > 0) {
+        OrderId current_order = ready_queue_min(ready_orders); // Ordine pronto più vecchio
+        int current_order_weight = order_weight(current_order);
+        // Controlla se l'ordine corrente può essere caricato
+        if (current_order_weight <= remaining_capacity) {
+            // Riduci la capacità rimanente
+            remaining_capacity -= current_order_weight;
+
+            // Rimuovi l'ordine dalla coda
+            remove_min_ready_order(ready_orders);
+
+            // Aggiungi l'ordine in coda all'array orders_to_load
+            if (batch->size == batch->capacity) {
+                batch->capacity = batch->capacity == 0 ? 64 : batch->capacity * 2;
+                batch->records = realloc(batch->records, batch->capacity * sizeof(CourierRecord));
+                batch->scratch = realloc(batch->scratch, batch->capacity * sizeof(CourierRecord));
+            }
+            batch->records[batch->size].weight = current_order_weight;
+            batch->records[batch->size].order = current_order;
+            batch->size++;
+
+        } else {
+            // L'ordine corrente eccede la capacità, interrompi
+            break;
+        }
+    }
+    }
+}
+
+// Radix sort LSD stabile per peso decrescente: a parità di peso resta l'ordine di arrivo (tick crescente)
+void sort_orders_to_load(CourierBatch *batch) {
+    int n = batch->size;
+    CourierRecord *from = batch->records;
+    CourierRecord *to = batch->scratch;
+
+    for (int shift = 0; shift < 32; shift += 8) {
+        int count[256] = {0};
+        for (int i = 0; i < n; i++) {
+            count[((unsigned int)from[i].weight >> shift) & 0xFF]++;
+        }
+        if (count[((unsigned int)from[0].weight >> shift) & 0xFF] == n) {
+            continue;  // Tutti i pesi hanno lo stesso byte: passata inutile
+        }
+        // Posizioni di partenza dei secchi, dal byte più alto al più basso
+        int position = 0;
+        for (int digit = 255; digit >= 0; digit--) {
+            int size = count[digit];
+            count[digit] = position;
+            position += size;
+        }
+        for (int i = 0; i < n; i++) {
+            to[count[((unsigned int)from[i].weight >> shift) & 0xFF]++] = from[i];
+        }
+        CourierRecord *temp = from;
+        from = to;
+        to = temp;
+    }
+    batch->records = from;
+    batch->scratch = to;
+}
+
+// Funzione per "caricare" il corriere
+void load_courier(int courier_capacity, ReadyQueue *ready_orders) {
+    // scelgo che ordini caricare
+    choose_orders_to_load(courier_capacity, ready_orders);
+    if (bakery->orders_to_load.size == 0) {
+        output_text("camioncino vuoto\n");
+        return;
+    }
+    STAT_ADD(STAT_COURIER_ORDERS, bakery->orders_to_load.size);
+    STAT_RECORD(HIST_COURIER_BATCH, bakery->orders_to_load.size);
+    // ordino gli ordini da caricare
+    sort_orders_to_load(&bakery->orders_to_load);
+
+    OrderStore *orders = &bakery->orders;
+    for (int i = 0; i < bakery->orders_to_load.size; i++) {
+        OrderId current = bakery->orders_to_load.records[i].order;
+        Recipe *recipe = order_recipe(current);
+        // Stampa il nome della ricetta
+        output_int(orders->tick[current]);
+        output_char(' ');
+        output_text(recipe->name);
+        output_char(' ');
+        output_int(orders->quantity[current]);
+        output_char('\n');
+        recipe->outstanding_orders--;  // L'ordine è stato spedito
+        order_free(orders, current);
+    }
+    bakery->orders_to_load.size = 0;
+}
+
+// ****____****____****____****____**** GESTIONE ORDINI ****____****____****____****____****
+
+// Accoda un ordine alla lista degli ordini in attesa della sua ricetta
+void append_pending_order(OrderId order) {
+    OrderStore *orders = &bakery->orders;
+    Recipe *recipe = order_recipe(order);
+    orders->next[order] = NO_ORDER;
+    recipe->waiting_orders++;
+    if (recipe->pending_orders.tail == NO_ORDER) {
+        // La lista è vuota: la ricetta diventa dipendente dai suoi ingredienti
+        recipe->pending_orders.head = order;
+        register_waiting_recipe(recipe);
+    } else {
+        orders->next[recipe->pending_orders.tail] = order;
+    }
+    recipe->pending_orders.tail = order;
+}
+
+// Rimuove un ordine dalla lista degli ordini in attesa della sua ricetta, dato l'ordine che lo precede
+// (NO_ORDER se è la testa): la lista è semplice, gli ordini escono solo durante la scansione di check_orders
+void remove_pending_order(Recipe *recipe, OrderId order, OrderId previous) {
+    OrderStore *orders = &bakery->orders;
+    OrderList *list = &recipe->pending_orders;
+    recipe->waiting_orders--;
+    if (previous != NO_ORDER) {
+        orders->next[previous] = orders->next[order];
+    } else {
+        list->head = orders->next[order];
+    }
+    if (list->tail == order) {
+        list->tail = previous;
+    }
+    if (list->head == NO_ORDER) {
+        // Nessun ordine in attesa: la ricetta non dipende più dai rifornimenti
+        unregister_waiting_recipe(recipe);
+    }
+}
+
+// Verifica scalare che ogni ingrediente copra quantities[i] * multiplier unità
+bool stock_covers_scalar(const int *stock, const int *ids, const int *quantities, int lanes, int multiplier) {
+    for (int i = 0; i < lanes; i++) {
+        if (stock[ids[i]] < quantities[i] * multiplier) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#ifdef HAVE_AVX2_DISPATCH
+// Stessa verifica, 8 ingredienti per volta: gather delle scorte, moltiplicazione e confronto vettoriali
+__attribute__((target("avx2")))
+bool stock_covers_avx2(const int *stock, const int *ids, const int *quantities, int lanes, int multiplier) {
+    __m256i factor = _mm256_set1_epi32(multiplier);
+    for (int i = 0; i < lanes; i += REQUIREMENT_LANES) {
+        __m256i available = _mm256_i32gather_epi32(stock, _mm256_loadu_si256((const __m256i *)(ids + i)), 4);
+        __m256i required = _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i *)(quantities + i)), factor);
+        __m256i missing = _mm256_cmpgt_epi32(required, available);
+        if (!_mm256_testz_si256(missing, missing)) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+// Implementazione della verifica scelta all'avvio in base alla CPU
+bool (*stock_covers_kernel)(const int *, const int *, const int *, int, int) = stock_covers_scalar;
+
+// Usa AVX2 se la CPU lo supporta, altrimenti resta la versione scalare
+void select_stock_kernel(void) {
+#ifdef HAVE_AVX2_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        stock_covers_kernel = stock_covers_avx2;
+    }
+#endif
+}
+
+// Vero se le scorte bastano per quantity unità della ricetta
+bool stock_covers(const Recipe *recipe, int quantity) {
+    return stock_covers_kernel(bakery->ingredient_stock, recipe->ingredient_ids, recipe->ingredient_quantities,
+                               recipe_lanes(recipe->ingredients_size), quantity);
+}
+
+// Quantità massima della ricetta producibile con le scorte attuali, ricalcolata solo se le scorte sono cambiate
+int recipe_max_makeable(Recipe *recipe) {
+    if (recipe->max_makeable_epoch != bakery->stock_epoch) {
+        int max = INT_MAX;
+        for (int i = 0; i < recipe->ingredients_size && max > 0; i++) {
+            if (recipe->ingredient_quantities[i] == 0) {
+                continue;  // Un ingrediente richiesto in quantità nulla non limita la produzione
+            }
+            int available = bakery->ingredient_stock[recipe->ingredient_ids[i]] / recipe->ingredient_quantities[i];
+            if (available < max) {
+                max = available;
+            }
+        }
+        recipe->max_makeable = max;
+        recipe->max_makeable_epoch = bakery->stock_epoch;
+    }
+    return recipe->max_makeable;
+}
+
+// Esegue un ordine se è stato verificato con successo
+void make_order(OrderId order, ReadyQueue *ready_orders) {
+
+    Recipe *recipe = order_recipe(order);
+    int quantity = bakery->orders.quantity[order];
+    // Sottrai gli ingredienti dai lotti
+    for(int i=0; i<recipe->ingredients_size; i++) {
+        int total_required = recipe->ingredient_quantities[i] * quantity;
+        int id = recipe->ingredient_ids[i];
+        Ingredient *ingredient = &bakery->ingredient_by_id[id];
+
+        // Sottrai la quantità dal totale disponibile dell'ingrediente
+        bakery->ingredient_stock[id] -= total_required;
+
+        // Sottrai la quantità dai lotti, a partire da quelli più vicini alla scadenza
+        consume_lots(&ingredient->lots, total_required);
+    }
+
+    // Le scorte degli altri sono cambiate, ma il massimo della ricetta scende esattamente della quantità prodotta
+    bool max_was_valid = recipe->max_makeable_epoch == bakery->stock_epoch;
+    bakery->stock_epoch++;
+    if (max_was_valid) {
+        recipe->max_makeable -= quantity;
+        recipe->max_makeable_epoch = bakery->stock_epoch;
+    }
+
+    // Ora l'ordine è pronto
+    insert_ready_order(ready_orders, order);
+}
+
+// Controlla se l'ordine può essere eseguito
+bool check_order(Recipe *recipe, int quantity, int tick) {
+
+    // Scarta i lotti scaduti dall'ultimo rifornimento prima di leggere i totali
+    for(int i=0; i<recipe->ingredients_size; i++) {
+        expire_ingredient_lots(&bakery->ingredient_by_id[recipe->ingredient_ids[i]], tick);
+    }
+
+    // Verifica se ci sono abbastanza ingredienti per l'ordine
+    if (!stock_covers(recipe, quantity)) {
+        recipe->last_tick_check = tick;           //aggiorno il tick dell'ultimo fallimento
+        recipe->last_quantity_failed = quantity;  //aggiorno la quantità dell'ultimo fallimento
+        return false;
+    }
+    return true;
+}
+
+// Inserisci un nuovo ordine in coda, controlla se esiste la ricetta e assegna il peso
+void add_order(const NameKey *recipe_key, int quantity, int tick, ReadyQueue *ready_orders) {
+    Recipe *recipe = find_recipe(recipe_key);
+    if (recipe == NULL) {
+        output_text("rifiutato\n");
+        return;
+    }
+
+    OrderId newOrder = order_alloc(&bakery->orders);
+    bakery->orders.recipe[newOrder] = recipe->id;
+    bakery->orders.quantity[newOrder] = quantity;
+    bakery->orders.tick[newOrder] = tick;
+    recipe->outstanding_orders++;
+    output_text("accettato\n");
+
+    // Se la ricetta con quantità minore o uguale è già fallita con lo scorso rifornimento non eseguo il check_order.
+    // Una ricetta di peso nullo non dipende da nessun rifornimento che potrebbe risvegliarla: va sempre controllata
+    if(!(recipe->weight > 0 && recipe->last_tick_check >= bakery->last_supply_tick && quantity >= recipe->last_quantity_failed) && check_order(recipe, quantity, tick)) {
+        make_order(newOrder, ready_orders);
+    } else {
+        append_pending_order(newOrder);
+    }
+}
+
+// Sistema verso il basso la ricetta in posizione index del min-heap delle candidate
+void heapify_down_recipes(MinHeap_recipes *heap, int index) {
+    while (true) {
+        int smallest = index;
+        int left = 2 * index + 1;
+        int right = 2 * index + 2;
+        if (left < heap->size && heap->recipes[left].tick < heap->recipes[smallest].tick) {
+            smallest = left;
+        }
+        if (right < heap->size && heap->recipes[right].tick < heap->recipes[smallest].tick) {
+            smallest = right;
+        }
+        if (smallest == index) {
+            return;
+        }
+        CandidateRecipe temp = heap->recipes[index];
+        heap->recipes[index] = heap->recipes[smallest];
+        heap->recipes[smallest] = temp;
+        index = smallest;
+    }
+}
+
+// Aggiunge alle candidate le ricette in attesa dell'ingrediente appena rifornito (il min-heap è costruito da check_orders)
+void enqueue_waiting_recipes(int id, int tick) {
+    Ingredient *ingredient = &bakery->ingredient_by_id[id];
+    MinHeap_recipes *heap = &bakery->candidate_recipes;
+    for (int k = 0; k < ingredient->waiting_size; k++) {
+        Recipe *recipe = ingredient->waiting[k].recipe;
+        if (recipe->candidate_tick == tick) {
+            continue;  // Già tra le candidate di questo rifornimento
+        }
+        recipe->candidate_tick = tick;
+
+        if (heap->size == heap->capacity) {
+            heap->capacity = heap->capacity == 0 ? 16 : heap->capacity * 2;
+            heap->recipes = realloc(heap->recipes, heap->capacity * sizeof(CandidateRecipe));
+        }
+        heap->recipes[heap->size++].recipe = recipe;
+    }
+}
+
+// Segna la ricetta come fallita per ogni quantità da failed_quantity in su, fino al prossimo rifornimento
+void record_recipe_failure(Recipe *recipe, int tick, int failed_quantity) {
+    recipe->last_tick_check = tick;
+    recipe->last_quantity_failed = failed_quantity;
+}
+
+// Controlla, in ordine cronologico, gli ordini in attesa delle ricette toccate dal rifornimento
+void check_orders(ReadyQueue *ready_orders, int tick) {
+    MinHeap_recipes *heap = &bakery->candidate_recipes;
+    OrderStore *orders = &bakery->orders;
+
+    // Passata vettoriale sulle candidate: scarta quelle che non possono produrre nemmeno una unità
+    int size = 0;
+    for (int i = 0; i < heap->size; i++) {
+        Recipe *recipe = heap->recipes[i].recipe;
+        if (!stock_covers(recipe, 1)) {
+            record_recipe_failure(recipe, tick, 1);
+            continue;
+        }
+        recipe->cursor = recipe->pending_orders.head;
+        recipe->cursor_before = NO_ORDER;
+        heap->recipes[size].tick = bakery->orders.tick[recipe->cursor];
+        heap->recipes[size].recipe = recipe;
+        size++;
+    }
+    STAT_ADD(STAT_RESTOCKS, 1);
+    STAT_ADD(STAT_CANDIDATES, heap->size);
+    STAT_ADD(STAT_CANDIDATES_SCREENED_OUT, heap->size - size);
+    heap->size = size;
+    for (int i = size / 2 - 1; i >= 0; i--) {
+        heapify_down_recipes(heap, i);
+    }
+
+    int orders_made = 0;
+    while (heap->size > 0) {
+        // Prendi l'ordine più vecchio tra quelle delle ricette candidate
+        Recipe *recipe = heap->recipes[0].recipe;
+        int max = recipe_max_makeable(recipe);
+        if (max == 0) {
+            // Le scorte sono finite: nessun altro ordine della ricetta può essere prodotto
+            record_recipe_failure(recipe, tick, 1);
+            heap->recipes[0] = heap->recipes[--heap->size];
+            heapify_down_recipes(heap, 0);
+            continue;
+        }
+
+        OrderId current_order = recipe->cursor;
+        recipe->cursor = orders->next[current_order];
+        if (recipe->cursor == NO_ORDER) {
+            heap->recipes[0] = heap->recipes[--heap->size];
+        } else {
+            heap->recipes[0].tick = orders->tick[recipe->cursor];
+        }
+        heapify_down_recipes(heap, 0);
+        STAT_ADD(STAT_PENDING_SCANNED, 1);
+
+        // Un solo confronto decide se l'ordine può essere eseguito
+        if (orders->quantity[current_order] <= max) {
+            remove_pending_order(recipe, current_order, recipe->cursor_before);
+            make_order(current_order, ready_orders);
+            orders_made++;
+        } else {
+            recipe->cursor_before = current_order;
+            record_recipe_failure(recipe, tick, max + 1);
+        }
+    }
+    STAT_ADD(STAT_ORDERS_MADE_ON_RESTOCK, orders_made);
+    STAT_RECORD(HIST_ORDERS_PER_RESTOCK, orders_made);
+}
+
+void free_all_memory() {
+    // Ricette, nomi e lotti vivono nell'arena: basta rilasciarli in blocco
+    order_store_release(&bakery->orders);
+    arena_reset(&bakery->catalog_arena);
+    arena_reset(&bakery->lot_arena);
+
+    free(bakery->ingredient_by_id);
+    free(bakery->ingredient_stock);
+    free(bakery->ingredient_table.ctrl);
+    free(bakery->ingredient_table.slots);
+    free(bakery->recipe_table.ctrl);
+    free(bakery->recipe_table.slots);
+    free(bakery->recipe_by_id);
+    free(bakery->free_recipe_ids);
+    free(bakery->candidate_recipes.recipes);
+    free(bakery->expiration_queue.events);
+    free(bakery->orders_to_load.records);
+    free(bakery->orders_to_load.scratch);
+}
+
+// Prepara una simulazione vuota che scrive le risposte su output_fd
+void init_bakery(Bakery *new_bakery, int output_fd) {
+    memset(new_bakery, 0, offsetof(Bakery, output));
+    new_bakery->last_supply_tick = -1;
+    new_bakery->stock_epoch = 1;
+    order_store_init(&new_bakery->orders);
+    new_bakery->output.block = &new_bakery->output.own_block;
+    new_bakery->output.data = new_bakery->output.own_block.data;
+    new_bakery->output.pipeline = NULL;
+    new_bakery->output.capture = NULL;
+    new_bakery->output.size = 0;
+    new_bakery->output.fd = output_fd;
+    new_bakery->output.flush_each_command = false;
+    new_bakery->output.discard = false;
+}
+
+// Riporta la simulazione corrente allo stato iniziale: la memoria dell'arena torna al sistema in blocco,
+// tabelle e array restano allocati per la prossima simulazione
+void reset_bakery(void) {
+    order_store_clear(&bakery->orders);
+    arena_reset(&bakery->catalog_arena);
+    arena_reset(&bakery->lot_arena);
+    hash_table_clear(&bakery->ingredient_table);
+    hash_table_clear(&bakery->recipe_table);
+    bakery->ingredient_count = 0;
+    bakery->recipe_count = 0;
+    bakery->free_recipe_count = 0;
+    bakery->candidate_recipes.size = 0;
+    bakery->expiration_queue.size = 0;
+    bakery->orders_to_load.size = 0;
+    bakery->last_supply_tick = -1;
+    bakery->stock_epoch = 1;
+    bakery->memory_after_compaction = 0;
+    bakery->memory_compactions = 0;
+    bakery->memory_limit_exceeded = false;
+    bakery->output.size = 0;
+}
+
+// ****____****____****____****____**** LETTURA INPUT ****____****____****____****____****
+
+// Prepara l'input: i file regolari vengono mappati, pipe e terminali letti a blocchi
+void scanner_open(InputScanner *in, int fd) {
+    struct stat info;
+    in->fd = fd;
+    in->pos = 0;
+    in->eof = false;
+    in->mapped = false;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, info.st_size, MADV_SEQUENTIAL);
+            in->data = map;
+            in->size = info.st_size;
+            in->capacity = 0;
+            in->mapped = true;
+            return;
+        }
+    }
+    in->data = malloc(INPUT_CHUNK_SIZE);
+    in->size = 0;
+    in->capacity = INPUT_CHUNK_SIZE;
+}
+
+void scanner_close(InputScanner *in) {
+    if (in->mapped) {
+        munmap(in->data, in->size);
+    } else {
+        free(in->data);
+    }
+}
+
+// Sposta in testa la riga incompleta e legge il blocco successivo
+void scanner_refill(InputScanner *in) {
+    size_t remaining = in->size - in->pos;
+    memmove(in->data, in->data + in->pos, remaining);
+    in->size = remaining;
+    in->pos = 0;
+    if (in->size == in->capacity) {
+        // Riga più lunga del buffer: raddoppialo
+        in->capacity *= 2;
+        in->data = realloc(in->data, in->capacity);
+    }
+    ssize_t bytes = read(in->fd, in->data + in->size, in->capacity - in->size);
+    while (bytes < 0 && errno == EINTR) {
+        bytes = read(in->fd, in->data + in->size, in->capacity - in->size);
+    }
+    if (bytes <= 0) {
+        in->eof = true;
+    } else {
+        in->size += bytes;
+    }
+}
+
+// Restituisce la prossima riga in [*line, *line_end), senza copiarla; false a fine input
+bool scanner_next_line(InputScanner *in, char **line, char **line_end) {
+    while (true) {
+        char *start = in->data + in->pos;
+        size_t available = in->size - in->pos;
+        char *newline = memchr(start, '\n', available);
+        if (newline != NULL) {
+            *line = start;
+            *line_end = newline;
+            in->pos += newline - start + 1;
+            return true;
+        }
+        if (in->mapped || in->eof) {
+            // Ultima riga senza '\n'
+            if (available == 0) {
+                return false;
+            }
+            *line = start;
+            *line_end = start + available;
+            in->pos = in->size;
+            return true;
+        }
+        scanner_refill(in);
+    }
+}
+
+// Legge un nome fino al prossimo spazio, calcolandone l'hash nello stesso passaggio
+NameKey scan_name(char **cursor, char *end) {
+    char *c = *cursor;
+    while (c < end && *c == ' ') {
+        c++;
+    }
+    NameKey key;
+    key.str = c;
+    unsigned int hash = FNV_OFFSET_BASIS;
+    while (c < end && *c != ' ') {
+        hash = xor(hash, *c);
+        hash *= FNV_PRIME;
+        c++;
+    }
+    key.length = c - key.str;
+    key.hash = hash;
+    *cursor = c;
+    return key;
+}
+
+// Legge un intero non negativo, false se non ci sono cifre
+bool scan_int(char **cursor, char *end, int *value) {
+    char *c = *cursor;
+    while (c < end && *c == ' ') {
+        c++;
+    }
+    int result = 0;
+    char *digits = c;
+    while (c < end && *c >= '0' && *c <= '9') {
+        result = result * 10 + (*c - '0');
+        c++;
+    }
+    *cursor = c;
+    *value = result;
+    return c != digits;
+}
+
+// Vero se sulla riga resta almeno un altro token
+bool scan_has_token(char **cursor, char *end) {
+    while (*cursor < end && **cursor == ' ') {
+        (*cursor)++;
+    }
+    return *cursor < end;
+}
+
+// Aggiunge un elemento vuoto in coda alla lista del comando
+CommandItem *command_next_item(Command *command) {
+    if (command->items_size == command->items_capacity) {
+        command->items_capacity = command->items_capacity == 0 ? 16 : command->items_capacity * 2;
+        command->items = realloc(command->items, command->items_capacity * sizeof(CommandItem));
+    }
+    return &command->items[command->items_size++];
+}
+
+bool name_equals(const NameKey *key, const char *name) {
+    return key->length == strlen(name) && memcmp(key->str, name, key->length) == 0;
+}
+
+// Analizza una riga in un solo passaggio: il primo byte sceglie il comando candidato, la parola intera lo conferma
+void parse_command(char *line, char *end, Command *command) {
+    char *cursor = line;
+    NameKey word = scan_name(&cursor, end);
+    command->items_size = 0;
+    command->type = CMD_SCONOSCIUTO;
+    command->name = word;
+    if (word.length == 0) {
+        return;
+    }
+
+    switch (word.str[0]) {
+        case 'a':  // aggiungi_ricetta <ricetta> (<ingrediente> <quantità>)...
+            if (!name_equals(&word, "aggiungi_ricetta")) {
+                break;
+            }
+            command->type = CMD_AGGIUNGI_RICETTA;
+            command->name = scan_name(&cursor, end);
+            while (scan_has_token(&cursor, end)) {
+                CommandItem *item = command_next_item(command);
+                item->name = scan_name(&cursor, end);
+                scan_int(&cursor, end, &item->quantity);
+            }
+            break;
+        case 'o':  // ordine <ricetta> <quantità>
+            if (!name_equals(&word, "ordine")) {
+                break;
+            }
+            command->type = CMD_ORDINE;
+            command->name = scan_name(&cursor, end);
+            scan_int(&cursor, end, &command->quantity);
+            break;
+        case 'r':  // rimuovi_ricetta <ricetta> | rifornimento (<ingrediente> <quantità> <scadenza>)...
+            if (name_equals(&word, "rimuovi_ricetta")) {
+                command->type = CMD_RIMUOVI_RICETTA;
+                command->name = scan_name(&cursor, end);
+            } else if (name_equals(&word, "rifornimento")) {
+                command->type = CMD_RIFORNIMENTO;
+                while (scan_has_token(&cursor, end)) {
+                    CommandItem *item = command_next_item(command);
+                    item->name = scan_name(&cursor, end);
+                    scan_int(&cursor, end, &item->quantity);
+                    scan_int(&cursor, end, &item->expiration);
+                }
+            }
+            break;
+        case 'i':  // in_sospeso <ricetta>
+            if (name_equals(&word, "in_sospeso")) {
+                command->type = CMD_IN_SOSPESO;
+                command->name = scan_name(&cursor, end);
+            }
+            break;
+        case 's':  // scorta <ingrediente>
+            if (name_equals(&word, "scorta")) {
+                command->type = CMD_SCORTA;
+                command->name = scan_name(&cursor, end);
+            }
+            break;
+        case 'p':  // peso_pronti | prossimo_corriere
+            if (name_equals(&word, "peso_pronti")) {
+                command->type = CMD_PESO_PRONTI;
+            } else if (name_equals(&word, "prossimo_corriere")) {
+                command->type = CMD_PROSSIMO_CORRIERE;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// ****____****____****____****____**** GESTIONE MEMORIA ****____****____****____****____****
+
+const char *const memory_subsystem_names[MEMORY_SUBSYSTEMS] = {"catalogo", "lotti", "ordini_in_attesa", "ordini_pronti"};
+
+size_t hash_table_bytes(const HashTable *table) {
+    return (size_t)table->capacity * (1 + sizeof(HashSlot));
+}
+
+// Byte di ogni sottosistema della simulazione corrente, calcolati in O(1) dalle capacità dei contenitori
+void memory_usage(const ReadyQueue *ready_orders, size_t usage[MEMORY_SUBSYSTEMS]) {
+    size_t order_row = sizeof(unsigned int) + 2 * sizeof(int) + sizeof(OrderId);
+    size_t ready_words = ready_orders->capacity / 64;
+    usage[MEMORY_CATALOG] = bakery->catalog_arena.bytes + hash_table_bytes(&bakery->ingredient_table) +
+                            hash_table_bytes(&bakery->recipe_table) +
+                            (size_t)bakery->ingredient_capacity * (sizeof(Ingredient) + sizeof(int)) +
+                            (size_t)bakery->recipe_capacity * (sizeof(Recipe *) + sizeof(int));
+    usage[MEMORY_LOTS] = bakery->lot_arena.bytes + (size_t)bakery->expiration_queue.capacity * sizeof(Expiration);
+    usage[MEMORY_PENDING] = (size_t)(bakery->orders.capacity - ready_orders->size) * order_row +
+                            (size_t)bakery->candidate_recipes.capacity * sizeof(CandidateRecipe);
+    usage[MEMORY_READY] = (size_t)ready_orders->size * order_row +
+                          (size_t)ready_orders->capacity * sizeof(OrderId) +
+                          (ready_words + (ready_words + 63) / 64) * sizeof(unsigned long long) +
+                          (size_t)(ready_orders->capacity + 1) * (sizeof(long long) + sizeof(int)) +
+                          (size_t)bakery->orders_to_load.capacity * 2 * sizeof(CourierRecord);
+}
+
+size_t memory_total(const ReadyQueue *ready_orders) {
+    size_t usage[MEMORY_SUBSYSTEMS];
+    memory_usage(ready_orders, usage);
+    size_t total = 0;
+    for (int i = 0; i < MEMORY_SUBSYSTEMS; i++) {
+        total += usage[i];
+    }
+    return total;
+}
+
+// Memoria residente del processo letta da /proc, comprese le pagine dell'input mappato (0 se non disponibile)
+size_t resident_memory(void) {
+    char text[64];
+    int fd = open("/proc/self/statm", O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    ssize_t length = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    if (length <= 0) {
+        return 0;
+    }
+    text[length] = '\0';
+    unsigned long pages = 0;
+    if (sscanf(text, "%*s %lu", &pages) != 1) {
+        return 0;
+    }
+    return pages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+// Copia l'ordine order di from nella prima riga libera di to, ritorna il nuovo ID
+OrderId copy_order(OrderStore *to, const OrderStore *from, OrderId order) {
+    OrderId moved = to->size++;
+    to->recipe[moved] = from->recipe[order];
+    to->quantity[moved] = from->quantity[order];
+    to->tick[moved] = from->tick[order];
+    to->live++;
+    return moved;
+}
+
+// Rinumera gli ordini da 1 in colonne di capacity righe: prima quelli in attesa, ricetta per ricetta
+// e in ordine di lista, poi quelli pronti. Va chiamata fuori da check_orders (i cursori non vengono aggiornati)
+void compact_order_store(ReadyQueue *ready_orders, unsigned int capacity) {
+    STAT_ADD(STAT_SHRINKS, 1);
+    OrderStore *old = &bakery->orders;
+    OrderStore store;
+    order_store_init(&store);
+    order_store_reserve(&store, capacity);
+    for (int id = 0; id < bakery->recipe_count; id++) {
+        Recipe *recipe = bakery->recipe_by_id[id];
+        if (recipe == NULL || recipe->pending_orders.head == NO_ORDER) {
+            continue;
+        }
+        OrderId previous = NO_ORDER;
+        for (OrderId order = recipe->pending_orders.head; order != NO_ORDER; order = old->next[order]) {
+            OrderId moved = copy_order(&store, old, order);
+            if (previous == NO_ORDER) {
+                recipe->pending_orders.head = moved;
+            } else {
+                store.next[previous] = moved;
+            }
+            previous = moved;
+        }
+        store.next[previous] = NO_ORDER;
+        recipe->pending_orders.tail = previous;
+    }
+    for (int word = 0; word < ready_orders->capacity / 64; word++) {
+        for (unsigned long long mask = ready_orders->bits[word]; mask != 0; mask &= mask - 1) {
+            int position = word * 64 + __builtin_ctzll(mask);
+            ready_orders->orders[position] = copy_order(&store, old, ready_orders->orders[position]);
+        }
+    }
+    order_store_release(old);
+    *old = store;
+}
+
+// Dopo il corriere: riduce tabella degli ordini e coda degli ordini pronti se occupate per meno di un quarto
+void shrink_order_containers(ReadyQueue *ready_orders, int tick) {
+    OrderStore *orders = &bakery->orders;
+    if (orders->capacity > ORDER_STORE_INITIAL_CAPACITY && (orders->live + 1) * 4 <= orders->capacity) {
+        compact_order_store(ready_orders, orders->capacity / 2);
+    }
+    shrink_ready_queue(ready_orders, tick);
+}
+
+// Porta ogni contenitore alla dimensione minima per il suo contenuto e restituisce al sistema
+// la memoria dei lotti, ricopiandoli in un'arena nuova
+void compact_memory(ReadyQueue *ready_orders) {
+    // Un quarto di righe in più: i prossimi ordini non fanno subito raddoppiare le colonne
+    unsigned int rows = bakery->orders.live + bakery->orders.live / 4 + 1;
+    if (rows < ORDER_STORE_INITIAL_CAPACITY) {
+        rows = ORDER_STORE_INITIAL_CAPACITY;
+    }
+    if (rows < bakery->orders.capacity) {
+        compact_order_store(ready_orders, rows);
+    }
+    if (ready_queue_needed_capacity(ready_orders) < ready_orders->capacity) {
+        relocate_ready_queue(ready_orders, ready_queue_needed_capacity(ready_orders));
+    }
+
+    Arena lot_arena;
+    memset(&lot_arena, 0, sizeof(Arena));
+    for (int id = 0; id < bakery->ingredient_count; id++) {
+        LotCalendar *calendar = &bakery->ingredient_by_id[id].lots;
+        if (calendar->lots == calendar->inline_lots) {
+            continue;
+        }
+        int size = calendar->size - calendar->head;
+        int capacity = 8;
+        while (capacity < size) {
+            capacity *= 2;
+        }
+        move_lot_calendar(calendar, &lot_arena, NULL, size <= LOT_INLINE_CAPACITY ? LOT_INLINE_CAPACITY : capacity);
+    }
+    arena_reset(&bakery->lot_arena);
+    bakery->lot_arena = lot_arena;
+
+    MinHeap_expirations *expirations = &bakery->expiration_queue;
+    if (expirations->capacity > 64 && expirations->size * 2 < expirations->capacity) {
+        expirations->capacity = expirations->size < 64 ? 64 : expirations->size;
+        expirations->events = realloc(expirations->events, expirations->capacity * sizeof(Expiration));
+    }
+    // Il carico del corriere è vuoto tra un comando e l'altro: si rialloca al prossimo passaggio
+    free(bakery->orders_to_load.records);
+    free(bakery->orders_to_load.scratch);
+    bakery->orders_to_load.records = NULL;
+    bakery->orders_to_load.scratch = NULL;
+    bakery->orders_to_load.capacity = 0;
+
+    hash_table_shrink(&bakery->recipe_table);
+    hash_table_shrink(&bakery->ingredient_table);
+    bakery->memory_compactions++;
+}
+
+// Con --max-memory compatta quando la memoria contata si avvicina al limite. La compattazione successiva
+// richiede una crescita di 1/8 rispetto alla memoria rimasta dopo l'ultima: se il limite è troppo basso
+// le compattazioni restano poche e il loro costo complessivo lineare
+void enforce_memory_limit(ReadyQueue *ready_orders) {
+    size_t total = memory_total(ready_orders);
+    if (total <= memory_limit - memory_limit / MEMORY_COMPACT_MARGIN ||
+        total <= bakery->memory_after_compaction + bakery->memory_after_compaction / MEMORY_COMPACT_MARGIN) {
+        return;
+    }
+    compact_memory(ready_orders);
+    total = memory_total(ready_orders);
+    bakery->memory_after_compaction = total;
+    if (total > memory_limit && !bakery->memory_limit_exceeded) {
+        bakery->memory_limit_exceeded = true;
+        report_error("Memoria oltre il limite di --max-memory anche dopo la compattazione\n");
+    }
+}
+
+// Stampa su stderr la memoria contata per sottosistema e la memoria residente del processo
+void memory_report(const ReadyQueue *ready_orders) {
+    size_t usage[MEMORY_SUBSYSTEMS];
+    memory_usage(ready_orders, usage);
+    fprintf(stderr, "== memoria ==\n");
+    for (int i = 0; i < MEMORY_SUBSYSTEMS; i++) {
+        fprintf(stderr, "%-18s %12zu\n", memory_subsystem_names[i], usage[i]);
+    }
+    fprintf(stderr, "%-18s %12zu\n", "totale", memory_total(ready_orders));
+    fprintf(stderr, "%-18s %12zu\n", "limite", memory_limit);
+    fprintf(stderr, "%-18s %12zu\n", "rss", resident_memory());
+    fprintf(stderr, "%-18s %12d\n", "compattazioni", bakery->memory_compactions);
+}
+
+// Legge una dimensione in byte con suffisso opzionale K, M o G (potenze di 1024), 0 se non valida
+size_t parse_size(const char *text) {
+    char *end;
+    unsigned long long value = strtoull(text, &end, 10);
+    int shift = 0;
+    switch (*end) {
+        case 'K': case 'k': shift = 10; end++; break;
+        case 'M': case 'm': shift = 20; end++; break;
+        case 'G': case 'g': shift = 30; end++; break;
+        default: break;
+    }
+    if (end == text || *end != '\0' || value > (SIZE_MAX >> shift)) {
+        return 0;
+    }
+    return (size_t)value << shift;
+}
+
+// ****____****____****____****____**** ESECUZIONE DEI COMANDI ****____****____****____****____****
+
+// Fa passare il corriere se il tick è un suo multiplo
+void run_courier_if_due(int tick, int courier_frequency, int courier_capacity, ReadyQueue *ready_orders) {
+    if(tick % courier_frequency == 0 && tick != 0){
+        STAT_TIMER(courier_start);
+        load_courier(courier_capacity, ready_orders);
+        shrink_order_containers(ready_orders, tick);
+        STAT_TIMER_RECORD(HIST_CORRIERE_NS, courier_start);
+    }
+}
+
+// Esegue un comando già analizzato nel tick indicato
+void execute_command(const Command *command, int tick, ReadyQueue *ready_orders) {
+    STAT_TIMER(command_start);
+    switch (command->type) {
+        case CMD_AGGIUNGI_RICETTA:
+            // Aggiungi la ricetta con il nome e gli ingredienti letti
+            add_recipe(&command->name, command->items, command->items_size);
+            STAT_TIMER_RECORD(HIST_AGGIUNGI_RICETTA_NS, command_start);
+            break;
+
+        case CMD_RIMUOVI_RICETTA:
+            remove_recipe(&command->name);
+            STAT_TIMER_RECORD(HIST_RIMUOVI_RICETTA_NS, command_start);
+            break;
+
+        case CMD_RIFORNIMENTO:
+            // Rimuovi i lotti scaduti
+            remove_expired_lots(tick);
+            bakery->last_supply_tick = tick;
+            for (int i = 0; i < command->items_size; i++) {
+                const CommandItem *lot = &command->items[i];
+                // Aggiungi l'ingrediente con la quantità e la scadenza solo se la scadenza non è immediata e la quantità è >0
+                if (lot->expiration > tick && lot->quantity > 0) {
+                    int id = add_ingredient(&lot->name, lot->quantity, lot->expiration);
+                    // Solo le ricette che usano l'ingrediente possono sbloccare ordini in attesa
+                    enqueue_waiting_recipes(id, tick);
+                }
+            }
+            output_text("rifornito\n");
+            check_orders(ready_orders, tick);
+            STAT_TIMER_RECORD(HIST_RIFORNIMENTO_NS, command_start);
+            break;
+
+        case CMD_ORDINE:
+            add_order(&command->name, command->quantity, tick, ready_orders);
+            STAT_TIMER_RECORD(HIST_ORDINE_NS, command_start);
+            break;
+
+        default:
+            output_text("#Comando non riconosciuto: ");
+            output_string(command->name.str, command->name.length);
+            output_char('\n');
+            break;
+    }
+}
+
+bool is_query(const Command *command) {
+    return command->type >= CMD_SCORTA;
+}
+
+// Risponde a un'interrogazione con gli aggregati mantenuti dalle operazioni, senza visitare liste o code.
+// Vale per l'istante tick, prima dell'eventuale corriere di quel tick.
+void execute_query(const Command *command, int tick, int courier_capacity, const ReadyQueue *ready_orders) {
+    switch (command->type) {
+        case CMD_SCORTA: {
+            // Quantità utilizzabile al tick: i lotti già scaduti vengono scartati come farebbe un ordine
+            HashValue *value = hash_table_find(&bakery->ingredient_table, &command->name);
+            int stock = 0;
+            if (value != NULL) {
+                expire_ingredient_lots(&bakery->ingredient_by_id[value->id], tick);
+                stock = bakery->ingredient_stock[value->id];
+            }
+            output_int(stock);
+            output_char('\n');
+            break;
+        }
+        case CMD_IN_SOSPESO: {
+            // Ordini in attesa e ordini pronti non ancora spediti
+            Recipe *recipe = find_recipe(&command->name);
+            if (recipe == NULL) {
+                output_text("non presente\n");
+                break;
+            }
+            output_int(recipe->waiting_orders);
+            output_char(' ');
+            output_int(recipe->outstanding_orders - recipe->waiting_orders);
+            output_char('\n');
+            break;
+        }
+        case CMD_PESO_PRONTI:
+            output_int(ready_orders->size);
+            output_char(' ');
+            output_long(ready_orders->total_weight);
+            output_char('\n');
+            break;
+        default: {
+            int orders;
+            long long weight;
+            ready_queue_courier_preview(ready_orders, courier_capacity, &orders, &weight);
+            output_int(orders);
+            output_char(' ');
+            output_long(weight);
+            output_char('\n');
+            break;
         }
-        i++;
-        index = (hash1 + i * step) % RECIPE_TABLE_SIZE;
-    }
-
-    // Se la ricetta non esiste, creala
-    if (recipeTable[index] == NULL) {
-        // Ottieni la lista degli ingredienti
-        //IngredientNode *ingredient_list = recipe_ingredient_list(rest_of_line);
-        char *per_conta = rest_of_line;
-        int count = count_ingredients_recipe(per_conta);
-        IngredientNode *ingredient_array = malloc(count * sizeof(IngredientNode));
-
-        // Processa la stringa "rest_of_line" per ottenere ingredienti e quantità
-        int total_weight = 0;
-        char *ingredient_name = strtok(rest_of_line, " ");
-        for(i = 0; i < count; i++) {
-            // Crea un nuovo nodo per l'ingrediente
-            unsigned int hash = search_ingredient(ingredient_name);
-            if(hash == INGREDIENT_TABLE_SIZE) {
-                ingredient_array[i].name = malloc(sizeof(char)*(strlen(ingredient_name)) + 1);
-                strcpy(ingredient_array[i].name, ingredient_name);
-            }
-            else {
-                ingredient_array[i].name = NULL;
-            }
-            ingredient_array[i].quantity = string_to_int(strtok(NULL, " "));  // Leggi la quantità
-            ingredient_array[i].hash = hash;
-            total_weight += ingredient_array[i].quantity;
-
-            // Leggi il prossimo ingrediente
-            ingredient_name = strtok(NULL, " ");
-        }
-
-        Recipe *newRecipe = (Recipe*) malloc(sizeof(Recipe));
-        newRecipe->name = malloc(sizeof(char)*(strlen(recipe_name)) + 1);
-        strcpy(newRecipe->name, recipe_name);
-        newRecipe->weight = total_weight;
-        newRecipe->ingredients = ingredient_array;
-        newRecipe->last_quantity_failed = 0;
-        newRecipe->last_tick_check = 0;
-        newRecipe->ingredients_size = count;
-        recipeTable[index] = newRecipe;
-        printf("aggiunta\n");
-    } else {
-        printf("ignorato\n");
     }
 }
 
-// Funzione per cercare una ricetta, ritorna l'indice della ricetta
-unsigned int search_recipe(const char *recipe_name) {
-    unsigned int hash1 = fnv1a_hash(recipe_name) % RECIPE_TABLE_SIZE;  // Prima funzione hash (indice iniziale)
-    unsigned int step = hash1 % (RECIPE_TABLE_SIZE - 1) + 1;           // Passo incrementale
-    unsigned int index = hash1;  // Indice iniziale
-    unsigned int i = 0;          // Contatore di tentativi
+// ****____****____****____****____**** SNAPSHOT DELLO STATO ****____****____****____****____****
+
+// Formato (interi a 32 bit nell'ordine dei byte della macchina, nomi allineati a 4 byte):
+//   intestazione: magic[8] versione frequenza capienza tick last_supply_tick n_ingredienti n_ricette n_pronti
+//   ingrediente:  nome n_lotti {quantità scadenza}...            (in ordine di ID)
+//   ricetta:      nome n_ingredienti last_quantity_failed last_tick_check n_attesa
+//                 {ID quantità}... {quantità tick}...            (ordini in attesa in ordine di arrivo)
+//   ordine pronto: indice_ricetta quantità tick
+// Un nome è la sua lunghezza seguita dai byte, senza terminatore.
+
+// Salva tutto lo stato della pasticceria in path, ritorna false in caso di errore
+bool save_snapshot(const char *path, const ReadyQueue *ready_orders, int courier_frequency, int courier_capacity, int tick) {
+    BinaryWriter *writer = malloc(sizeof(BinaryWriter));
+    if (!binary_writer_open(writer, path)) {
+        free(writer);
+        return false;
+    }
+    binary_write(writer, SNAPSHOT_MAGIC, 8);
+    int header[] = {SNAPSHOT_VERSION, courier_frequency, courier_capacity, tick, bakery->last_supply_tick,
+                    bakery->ingredient_count, (int)bakery->recipe_table.size, ready_orders->size};
+    binary_write(writer, header, sizeof(header));
+
+    // Ingredienti con i lotti ancora presenti, dal più vicino alla scadenza
+    for (int id = 0; id < bakery->ingredient_count; id++) {
+        Ingredient *ingredient = &bakery->ingredient_by_id[id];
+        binary_write_name(writer, ingredient->name, (int)strlen(ingredient->name));
+        binary_write_int(writer, ingredient->lots.size - ingredient->lots.head);
+        binary_write(writer, ingredient->lots.lots + ingredient->lots.head,
+                     (ingredient->lots.size - ingredient->lots.head) * sizeof(Lot));
+    }
 
-    // Cerca la ricetta nella hash table
-    while (recipeTable[index] != NULL && strcmp(recipeTable[index]->name, recipe_name) != 0) {
-        if (i >= MAX_RECIPE_RETRIES) {
-            return RECIPE_TABLE_SIZE;
+    // Ricette con i loro ordini in attesa
+    int index = 0;
+    for (unsigned int i = 0; i < bakery->recipe_table.capacity; i++) {
+        if (bakery->recipe_table.ctrl[i] >= CTRL_EMPTY) {
+            continue;
+        }
+        Recipe *recipe = bakery->recipe_table.slots[i].value.pointer;
+        recipe->snapshot_index = index++;
+        int pending = recipe->waiting_orders;
+        binary_write_name(writer, recipe->name, (int)strlen(recipe->name));
+        int fields[] = {recipe->ingredients_size, recipe->last_quantity_failed, recipe->last_tick_check, pending};
+        binary_write(writer, fields, sizeof(fields));
+        for (int j = 0; j < recipe->ingredients_size; j++) {
+            binary_write_int(writer, recipe->ingredient_ids[j]);
+            binary_write_int(writer, recipe->ingredient_quantities[j]);
+        }
+        for (OrderId order = recipe->pending_orders.head; order != NO_ORDER; order = bakery->orders.next[order]) {
+            binary_write_int(writer, bakery->orders.quantity[order]);
+            binary_write_int(writer, bakery->orders.tick[order]);
         }
-        i++;
-        index = (hash1 + i * step) % RECIPE_TABLE_SIZE;
     }
 
-    // Verifica se la ricetta è stata trovata
-    Recipe *recipe = recipeTable[index];
-    if (recipe == NULL) { // Ricetta non trovata
-        return RECIPE_TABLE_SIZE;
+    // Ordini pronti, nell'ordine degli slot della coda
+    for (int word = 0; word < ready_orders->capacity / 64; word++) {
+        unsigned long long mask = ready_orders->bits[word];
+        while (mask != 0) {
+            OrderId order = ready_orders->orders[word * 64 + __builtin_ctzll(mask)];
+            int fields[] = {order_recipe(order)->snapshot_index, bakery->orders.quantity[order], bakery->orders.tick[order]};
+            binary_write(writer, fields, sizeof(fields));
+            mask &= mask - 1;
+        }
     }
 
-    return index;
+    bool ok = binary_writer_close(writer);
+    free(writer);
+    return ok;
 }
 
-// Funzione per rimuovere una ricetta
-void remove_recipe(const char *recipe_name, MinHeap_orders *ready_orders_heap) {
-    unsigned int index = search_recipe(recipe_name);
-    if (index == RECIPE_TABLE_SIZE) {
-        printf("non presente\n");
-        return;
+// Ricostruisce lo stato da uno snapshot su una pasticceria vuota, ritorna false se il file non è valido
+bool load_snapshot(const char *path, ReadyQueue *ready_orders, int *courier_frequency, int *courier_capacity, int *tick) {
+    BinaryReader reader;
+    if (!binary_reader_open(&reader, path)) {
+        return false;
+    }
+    if (reader.size < 8 || memcmp(reader.data, SNAPSHOT_MAGIC, 8) != 0) {
+        binary_reader_close(&reader);
+        return false;
+    }
+    reader.pos = 8;
+    int version = binary_read_int(&reader);
+    *courier_frequency = binary_read_int(&reader);
+    *courier_capacity = binary_read_int(&reader);
+    *tick = binary_read_int(&reader);
+    bakery->last_supply_tick = binary_read_int(&reader);
+    int ingredients = binary_read_int(&reader);
+    int recipes = binary_read_int(&reader);
+    int ready = binary_read_int(&reader);
+    if (version != SNAPSHOT_VERSION || *courier_frequency <= 0 || ingredients < 0 || recipes < 0 || ready < 0) {
+        reader.failed = true;
     }
-    Recipe *recipe = recipeTable[index];
 
-    // Verifica se ci sono ordini in attesa per questa ricetta
-    OrderNode *current_order = pending_orders_list.head;
-    while (current_order != NULL) {
-        if (current_order->recipe == recipe) {
-            printf("ordini in sospeso\n");
-            return;
+    for (int id = 0; id < ingredients && !reader.failed; id++) {
+        NameKey key;
+        binary_read_name(&reader, &key);
+        int lots = binary_read_int(&reader);
+        if (reader.failed || find_or_create_ingredient(&key) != id || lots < 0) {
+            reader.failed = true;
+            break;
+        }
+        for (int j = 0; j < lots && !reader.failed; j++) {
+            int quantity = binary_read_int(&reader);
+            int expiration = binary_read_int(&reader);
+            insert_lot(&bakery->ingredient_by_id[id].lots, quantity, expiration);
+            bakery->ingredient_stock[id] += quantity;
+        }
+        if (lots > 0) {
+            schedule_expiration(id, bakery->ingredient_by_id[id].lots.lots[0].expiration);
         }
-        current_order = current_order->next;
     }
-
-    // Verifica se ci sono ordini pronti per questa ricetta nel min-heap ready_orders_heap
-    if(ready_orders_heap != NULL){
-        for (int i = 0; i < ready_orders_heap->size; i++) {
-            if (ready_orders_heap->orders[i]->recipe == recipe) {
-                printf("ordini in sospeso\n");
-                return;
+    bakery->stock_epoch++;
+
+    // Le ricette vengono indicizzate nell'ordine del file per risolvere gli ordini pronti
+    Recipe **by_index = malloc((recipes > 0 ? recipes : 1) * sizeof(Recipe *));
+    for (int r = 0; r < recipes && !reader.failed; r++) {
+        NameKey key;
+        binary_read_name(&reader, &key);
+        int count = binary_read_int(&reader);
+        int last_quantity_failed = binary_read_int(&reader);
+        int last_tick_check = binary_read_int(&reader);
+        int pending = binary_read_int(&reader);
+        if (reader.failed || count < 0 || pending < 0 || find_recipe(&key) != NULL) {
+            reader.failed = true;
+            break;
+        }
+        Recipe *recipe = create_recipe(&key, count);
+        recipe->last_quantity_failed = last_quantity_failed;
+        recipe->last_tick_check = last_tick_check;
+        by_index[r] = recipe;
+        for (int j = 0; j < count; j++) {
+            int id = binary_read_int(&reader);
+            int quantity = binary_read_int(&reader);
+            if (id < 0 || id >= bakery->ingredient_count) {
+                reader.failed = true;
+                id = 0;
             }
+            set_recipe_ingredient(recipe, j, id, quantity);
+        }
+        for (int j = 0; j < pending && !reader.failed; j++) {
+            OrderId order = order_alloc(&bakery->orders);
+            bakery->orders.recipe[order] = recipe->id;
+            bakery->orders.quantity[order] = binary_read_int(&reader);
+            bakery->orders.tick[order] = binary_read_int(&reader);
+            recipe->outstanding_orders++;
+            append_pending_order(order);
         }
     }
 
-    // Non ci sono ordini in sospeso, possiamo rimuovere la ricetta
-    // Libera array degli ingredienti
-    IngredientNode *ingredient_array = recipe->ingredients;
-    for (int i = 0; i < recipe->ingredients_size; ++i) {
-        if(ingredient_array[i].name != NULL){
-            free(ingredient_array[i].name);
+    for (int i = 0; i < ready && !reader.failed; i++) {
+        int index = binary_read_int(&reader);
+        int quantity = binary_read_int(&reader);
+        int order_tick = binary_read_int(&reader);
+        if (reader.failed || index < 0 || index >= recipes) {
+            reader.failed = true;
+            break;
         }
+        OrderId order = order_alloc(&bakery->orders);
+        bakery->orders.recipe[order] = by_index[index]->id;
+        bakery->orders.quantity[order] = quantity;
+        bakery->orders.tick[order] = order_tick;
+        by_index[index]->outstanding_orders++;
+        insert_ready_order(ready_orders, order);
     }
-    free(ingredient_array);
+    free(by_index);
 
-    // Libera la ricetta e rimuovila dalla hash table
-    free(recipe->name);
-    free(recipe);
-    recipeTable[index] = NULL;  // Elimina la ricetta dalla hash table
-    printf("rimossa\n");
+    bool ok = !reader.failed && reader.pos == reader.size;
+    binary_reader_close(&reader);
+    return ok;
 }
 
-// ****____****____****____****____**** GESTIONE ORDINI DA CARICARE ****____****____****____****____****
+// ****____****____****____****____**** GIORNALE DEI COMANDI ****____****____****____****____****
+
+// Formato: intestazione magic[8] versione frequenza capienza tick_iniziale, poi un record per comando:
+//   tipo, seguito da  aggiungi_ricetta: nome n {nome quantità}...   rimuovi_ricetta: nome
+//                     rifornimento: n {nome quantità scadenza}...   ordine: nome quantità
+//                     comando sconosciuto: nome                     corriere finale: nulla
+// Il record i-esimo è il comando del tick tick_iniziale + i. Accanto al giornale, path.snap è
+// l'ultimo snapshot: la compattazione lo riscrive e svuota il giornale.
+
+// Percorso di un file accanto al giornale (da liberare)
+char *journal_sidecar_path(const char *suffix) {
+    size_t length = strlen(journal.path);
+    char *path = malloc(length + strlen(suffix) + 1);
+    memcpy(path, journal.path, length);
+    strcpy(path + length, suffix);
+    return path;
+}
 
-// Funzione per ridimensionare il Min-Heap
-void resize_minheap_orders(MinHeap_orders *heap) {
-    if(heap != NULL) {
-        if (heap->orders == NULL) return;
-        heap->capacity *= 2;  // Raddoppia la capacità
-        OrderNode **new_orders = (OrderNode **)realloc(heap->orders, heap->capacity * sizeof(OrderNode *));
-        if (new_orders == NULL) {
-            // Se realloc fallisce, stampa un errore o gestisci il fallimento
-            printf("Errore: impossibile allocare memoria per il MinHeap.\n");
-            return;
-        }
-        heap->orders = new_orders;
-    }
+void journal_write_header(int courier_frequency, int courier_capacity, int start_tick) {
+    binary_write(journal.writer, JOURNAL_MAGIC, 8);
+    int header[] = {JOURNAL_VERSION, courier_frequency, courier_capacity, start_tick};
+    binary_write(journal.writer, header, sizeof(header));
+    journal.pending_records++;
+    journal_sync();
 }
 
-// Inserisci un lotto in un min-heap (heapify)
-void insert_ready_order_in_minheap(MinHeap_orders *heap, OrderNode *order) {
-    if(heap != NULL){
-        if (heap->size == heap->capacity) {
-            resize_minheap_orders(heap);  // Ridimensiona il min-heap se pieno
-        }
-        heap->orders[heap->size] = order;
-        int i = heap->size;
-        heap->size++;
-        // Heapify verso l'alto
-        while (i > 0 && heap->orders[i]->tick < heap->orders[(i - 1) / 2]->tick) {
-            OrderNode *temp = heap->orders[i];
-            heap->orders[i] = heap->orders[(i - 1) / 2];
-            heap->orders[(i - 1) / 2] = temp;
-            i = (i - 1) / 2;
+// Apre il giornale in scrittura dopo i primi valid_length byte (i record validi), scartando il resto
+bool journal_open(const char *path, off_t valid_length) {
+    journal.path = path;
+    journal.writer = malloc(sizeof(BinaryWriter));
+    journal.writer->fd = open(path, O_WRONLY | O_CREAT, 0644);
+    journal.writer->size = 0;
+    journal.writer->failed = journal.writer->fd < 0 || ftruncate(journal.writer->fd, valid_length) != 0 ||
+                             lseek(journal.writer->fd, valid_length, SEEK_SET) != valid_length;
+    if (journal.writer->failed) {
+        if (journal.writer->fd >= 0) {
+            close(journal.writer->fd);
         }
+        free(journal.writer);
+        journal.writer = NULL;
+        return false;
     }
+    return true;
 }
 
-void heapify_down(MinHeap_orders *heap, int index) {
-    int smallest = index;
-    int left_child = 2 * index + 1;
-    int right_child = 2 * index + 2;
-
-    if(heap != NULL){
-        if (left_child < heap->size && heap->orders[left_child]->tick < heap->orders[smallest]->tick) {
-            smallest = left_child;
-        }
-        if (right_child < heap->size && heap->orders[right_child]->tick < heap->orders[smallest]->tick) {
-            smallest = right_child;
-        }
-
-        if (smallest != index) {
-            OrderNode *temp = heap->orders[index];
-            heap->orders[index] = heap->orders[smallest];
-            heap->orders[smallest] = temp;
-            heapify_down(heap, smallest);
-        }
+void journal_close(void) {
+    if (journal.writer == NULL) {
+        return;
     }
+    if (!binary_writer_close(journal.writer)) {
+        report_error("Errore durante la scrittura del giornale\n");
+    }
+    free(journal.writer);
+    journal.writer = NULL;
 }
 
-// Sceglie gli ordini da caricare e li sposta dal min_heap alla lista orders_to_load
-void choose_orders_to_load(int courier_capacity, MinHeap_orders *ready_orders_heap) {
-    int remaining_capacity = courier_capacity;
-
-    if(ready_orders_heap != NULL){
-        while (ready_orders_heap->size > 0) {
-        OrderNode *current_order = ready_orders_heap->orders[0]; // Radice del min-heap
-        int current_order_weight = current_order->quantity * current_order->recipe->weight;
-        // Controlla se l'ordine corrente può essere caricato
-        if (current_order_weight <= remaining_capacity) {
-            // Riduci la capacità rimanente
-            remaining_capacity -= current_order_weight;
-
-            // Rimuovi il nodo minimo dal heap
-            ready_orders_heap->orders[0] = ready_orders_heap->orders[ready_orders_heap->size - 1];
-            ready_orders_heap->size--;
-            heapify_down(ready_orders_heap, 0);
-
-            // Aggiungi l'ordine alla coda della lista orders_to_load
-            current_order->next = NULL;
-            current_order->prev = orders_to_load.tail;
-
-            if (orders_to_load.tail != NULL) {
-                (orders_to_load.tail)->next = current_order;
-            } else {
-                // Se la lista era vuota, aggiorna anche la testa
-                orders_to_load.head = current_order;
+// Registra un comando analizzato (durevole al prossimo group commit)
+void journal_append(const Command *command) {
+    if (journal.writer == NULL) {
+        return;
+    }
+    BinaryWriter *writer = journal.writer;
+    binary_write_int(writer, command->type);
+    switch (command->type) {
+        case CMD_AGGIUNGI_RICETTA:
+            binary_write_name(writer, command->name.str, command->name.length);
+            binary_write_int(writer, command->items_size);
+            for (int i = 0; i < command->items_size; i++) {
+                binary_write_name(writer, command->items[i].name.str, command->items[i].name.length);
+                binary_write_int(writer, command->items[i].quantity);
+            }
+            break;
+        case CMD_RIFORNIMENTO:
+            binary_write_int(writer, command->items_size);
+            for (int i = 0; i < command->items_size; i++) {
+                binary_write_name(writer, command->items[i].name.str, command->items[i].name.length);
+                binary_write_int(writer, command->items[i].quantity);
+                binary_write_int(writer, command->items[i].expiration);
             }
+            break;
+        case CMD_ORDINE:
+            binary_write_name(writer, command->name.str, command->name.length);
+            binary_write_int(writer, command->quantity);
+            break;
+        default:
+            binary_write_name(writer, command->name.str, command->name.length);
+            break;
+    }
+    if (++journal.pending_records >= JOURNAL_GROUP_COMMIT) {
+        journal_sync();
+    }
+}
 
-            // Aggiorna la coda
-            orders_to_load.tail = current_order;
+// Registra il passaggio del corriere a fine input, che la ripresa non deve ripetere
+void journal_append_courier(void) {
+    if (journal.writer != NULL) {
+        binary_write_int(journal.writer, JOURNAL_RECORD_COURIER);
+        journal.pending_records++;
+    }
+}
 
-        } else {
-            // L'ordine corrente eccede la capacità, interrompi
+// Legge il prossimo record in command; false a fine giornale o se l'ultimo record è incompleto
+bool journal_read_command(BinaryReader *reader, Command *command, int *record_type) {
+    size_t start = reader->pos;
+    if (start == reader->size) {
+        return false;
+    }
+    int type = binary_read_int(reader);
+    *record_type = type;
+    command->type = type;
+    command->items_size = 0;
+    command->name.length = 0;
+    switch (type) {
+        case CMD_AGGIUNGI_RICETTA:
+        case CMD_RIFORNIMENTO: {
+            if (type == CMD_AGGIUNGI_RICETTA) {
+                binary_read_name(reader, &command->name);
+            }
+            int count = binary_read_int(reader);
+            for (int i = 0; i < count && !reader->failed; i++) {
+                CommandItem *item = command_next_item(command);
+                binary_read_name(reader, &item->name);
+                item->quantity = binary_read_int(reader);
+                item->expiration = type == CMD_RIFORNIMENTO ? binary_read_int(reader) : 0;
+            }
             break;
         }
+        case CMD_ORDINE:
+            binary_read_name(reader, &command->name);
+            command->quantity = binary_read_int(reader);
+            break;
+        case CMD_RIMUOVI_RICETTA:
+        case CMD_SCONOSCIUTO:
+            binary_read_name(reader, &command->name);
+            break;
+        case JOURNAL_RECORD_COURIER:
+            break;
+        default:
+            reader->failed = true;
+            break;
     }
+    if (reader->failed) {
+        reader->pos = start;  // Record scritto a metà da un'esecuzione interrotta
+        return false;
     }
+    return true;
 }
 
-// Funzione quick-sort per ordinare la lista orders_to_load
-OrderNode *partition(OrderNode *low, OrderNode *high) {
-    int pivot_weight = high->quantity * high->recipe->weight; // Scelgo il peso come pivot
-    int pivot_tick = high->tick;          // Uso il tick per stabilità
-
-    OrderNode *i = low->prev; // Indice degli elementi più grandi
-
-    for (OrderNode *j = low; j != high; j = j->next) {
-        // Confronto per peso, poi per tick
-        int j_weight = j->quantity * j->recipe->weight;
-        if (j_weight > pivot_weight || (j_weight == pivot_weight && j->tick < pivot_tick)) {
-            // Incrementa l'indice di elementi più grandi
-            i = (i == NULL) ? low : i->next;
-
-            // Scambia i nodi i e j
-            Recipe *temp_recipe = i->recipe;
-            int temp_tick = i->tick;
-            int temp_quantity = i->quantity;
+// Ricostruisce lo stato da path.snap e dai record del giornale, senza produrre risposte.
+// *recovered è falso se non esiste nulla da recuperare; *valid_length è la lunghezza dei record validi
+// e *courier_done_tick il tick il cui corriere è già passato (-1 se nessuno).
+bool journal_recover(ReadyQueue *ready_orders, int *courier_frequency, int *courier_capacity, int *tick,
+                     bool *recovered, off_t *valid_length, int *courier_done_tick) {
+    *recovered = false;
+    *valid_length = 0;
+    *courier_done_tick = -1;
+    char *snapshot_path = journal_sidecar_path(".snap");
+    bool snapshot_loaded = access(snapshot_path, F_OK) == 0;
+    if (snapshot_loaded && !load_snapshot(snapshot_path, ready_orders, courier_frequency, courier_capacity, tick)) {
+        free(snapshot_path);
+        return false;
+    }
+    free(snapshot_path);
+    *recovered = snapshot_loaded;
 
-            i->recipe = j->recipe;
-            i->tick = j->tick;
-            i->quantity = j->quantity;
+    BinaryReader reader;
+    if (!binary_reader_open(&reader, journal.path)) {
+        return true;  // Giornale assente o vuoto
+    }
+    int header[4] = {0};
+    bool valid = reader.size >= 8 + sizeof(header) && memcmp(reader.data, JOURNAL_MAGIC, 8) == 0;
+    if (valid) {
+        memcpy(header, reader.data + 8, sizeof(header));
+        reader.pos = 8 + sizeof(header);
+        valid = header[0] == JOURNAL_VERSION && header[1] > 0;
+    }
+    // Senza snapshot il giornale deve partire dall'inizio, con uno snapshot non deve lasciare buchi
+    valid = valid && (snapshot_loaded ? header[3] <= *tick : header[3] == 0);
+    if (!valid) {
+        binary_reader_close(&reader);
+        return false;
+    }
+    if (!snapshot_loaded) {
+        *courier_frequency = header[1];
+        *courier_capacity = header[2];
+        *tick = 0;
+    }
 
-            j->recipe = temp_recipe;
-            j->tick = temp_tick;
-            j->quantity = temp_quantity;
+    // Riesegue i comandi successivi allo snapshot scartando le risposte
+    Command command = {0};
+    int record_type;
+    int record_tick = header[3];
+    bakery->output.discard = true;
+    while (journal_read_command(&reader, &command, &record_type)) {
+        if (record_type == JOURNAL_RECORD_COURIER) {
+            if (record_tick >= *tick) {
+                run_courier_if_due(record_tick, *courier_frequency, *courier_capacity, ready_orders);
+                *courier_done_tick = record_tick;
+            }
+            continue;
+        }
+        if (record_tick >= *tick) {
+            if (record_tick != *courier_done_tick) {
+                run_courier_if_due(record_tick, *courier_frequency, *courier_capacity, ready_orders);
+            }
+            execute_command(&command, record_tick, ready_orders);
+            *tick = record_tick + 1;
         }
+        record_tick++;
     }
+    output_flush();
+    bakery->output.discard = false;
+    free(command.items);
+
+    *recovered = true;
+    *valid_length = reader.pos;
+    binary_reader_close(&reader);
+    return true;
+}
 
-    // Scambia i+1 e il pivot
-    if (i == NULL) {
-        i = low;
+// Salva uno snapshot accanto al giornale e riparte con un giornale vuoto dal tick indicato
+void journal_compact(const ReadyQueue *ready_orders, int courier_frequency, int courier_capacity, int tick) {
+    journal_sync();
+    char *temporary_path = journal_sidecar_path(".snap.tmp");
+    char *snapshot_path = journal_sidecar_path(".snap");
+    // Lo snapshot sostituisce il precedente solo quando è completo su disco
+    if (save_snapshot(temporary_path, ready_orders, courier_frequency, courier_capacity, tick) &&
+        rename(temporary_path, snapshot_path) == 0) {
+        binary_writer_flush(journal.writer);
+        if (ftruncate(journal.writer->fd, 0) != 0 || lseek(journal.writer->fd, 0, SEEK_SET) != 0) {
+            journal.writer->failed = true;
+        }
+        journal_write_header(courier_frequency, courier_capacity, tick);
     } else {
-        i = i->next;
+        report_error("Errore durante la compattazione del giornale\n");
     }
+    journal.records_since_compaction = 0;
+    free(temporary_path);
+    free(snapshot_path);
+}
 
-    Recipe *temp_recipe = i->recipe;
-    int temp_tick = i->tick;
-    int temp_quantity = i->quantity;
-
-    i->recipe = high->recipe;
-    i->tick = high->tick;
-    i->quantity = high->quantity;
+// Esegue un comando analizzato nel suo tick, dopo il corriere se è il momento; ritorna il tick successivo
+// (lo stesso per le interrogazioni)
+int step_command(const Command *command, ReadyQueue *ready_orders, int courier_frequency, int courier_capacity,
+                 int tick, int courier_done_tick) {
+    if (is_query(command)) {
+        // Le interrogazioni non consumano tick e non vanno sul giornale
+        execute_query(command, tick, courier_capacity, ready_orders);
+        if (bakery->output.flush_each_command) {
+            output_flush();
+        }
+        return tick;
+    }
 
-    high->recipe = temp_recipe;
-    high->tick = temp_tick;
-    high->quantity = temp_quantity;
+    // Verifichiamo se è l'ora dello sbusto
+    if (tick != courier_done_tick) {
+        run_courier_if_due(tick, courier_frequency, courier_capacity, ready_orders);
+    }
 
-    return i;
+    journal_append(command);
+    execute_command(command, tick, ready_orders);
+    if (bakery->output.flush_each_command) {
+        output_flush();
+    }
+    if (memory_limit != 0) {
+        enforce_memory_limit(ready_orders);
+    }
+    STAT_POLL();
+    tick++;
+    if (journal.writer != NULL && journal.compaction_interval > 0 &&
+        ++journal.records_since_compaction >= journal.compaction_interval) {
+        journal_compact(ready_orders, courier_frequency, courier_capacity, tick);
+    }
+    return tick;
 }
 
-void quicksort(OrderNode *low, OrderNode *high) {
-    if (low && high != NULL && low != high && low != high->next) {
-        OrderNode *pivot = partition(low, high);
-
-        quicksort(low, pivot->prev);
-        quicksort(pivot->next, high);
+// Esegue i comandi dell'input a partire da tick, ritorna il tick successivo all'ultimo comando
+int run_commands(InputScanner *input, ReadyQueue *ready_orders, int courier_frequency, int courier_capacity,
+                 int tick, int courier_done_tick) {
+    char *line, *line_end;
+    Command command = {0};
+    // Leggi il file riga per riga
+    while (scanner_next_line(input, &line, &line_end)) {
+        parse_command(line, line_end, &command);
+        tick = step_command(&command, ready_orders, courier_frequency, courier_capacity, tick, courier_done_tick);
     }
+    free(command.items);
+    return tick;
 }
 
-// Funzione per "caricare" il corriere
-void load_courier(int courier_capacity, MinHeap_orders *ready_orders_heap) {
-    // scelgo che ordini caricare
-    choose_orders_to_load(courier_capacity, ready_orders_heap);
-    // ordino la lista orders_to_load
-    quicksort(orders_to_load.head, orders_to_load.tail);
-
-    int total_elements = 0;
-    OrderNode *current = orders_to_load.head;
+// ****____****____****____****____**** PIPELINE ****____****____****____****____****
 
-    while (current != NULL) {
-        // Stampa il nome della ricetta
-        printf("%d %s %d\n", current->tick, current->recipe->name, current->quantity);
-
-        // Salva il nodo corrente da eliminare
-        OrderNode *to_delete = current;
-
-        // Passa al prossimo nodo
-        current = current->next;
-
-        // Elimina il nodo corrente
-        free(to_delete);
+// Con --pipeline tre thread lavorano in parallelo: la lettura analizza le righe in gruppi di comandi,
+// il simulatore li esegue in ordine e la scrittura riversa sull'output i blocchi di risposte.
+// Le code tra i thread sono SPSC; gruppi e blocchi girano in tondo senza nuove allocazioni.
 
-        // Aggiorna la testa della lista
-        orders_to_load.head = current;
-        total_elements++;
-    }
-
-    // La lista è ora vuota, resetta la coda
-    orders_to_load.tail = NULL;
-    if(total_elements == 0){
-        printf("camioncino vuoto\n");
-    }
+void reset_command_batch(CommandBatch *batch) {
+    batch->size = 0;
+    batch->text_size = 0;
 }
 
-// ****____****____****____****____**** GESTIONE ORDINI ****____****____****____****____****
-
-// Sposta ordini da lista pending orders a minheap ordini pronti
-void move_order_to_minheap(OrderNode *order, MinHeap_orders *ready_orders_heap){
-    if (order == NULL) {
-        //Errore: ordine nullo
-        return;
-    }
-    // Rimuovi il nodo dalla lista pending_orders_list
-    if (order == pending_orders_list.head) {  // Nodo in testa
-        pending_orders_list.head = order->next; // Sposta la testa al prossimo ordine
-        if (pending_orders_list.head != NULL) { // Se l'ordine corrente esiste
-            pending_orders_list.head->prev = NULL; // imposta il precedente a NULL perché sei in testa
-        } else {
-            pending_orders_list.tail = NULL;  // La lista diventa vuota
+// Thread di lettura: riempie i gruppi di comandi, NULL in coda a fine input
+void *pipeline_parser(void *argument) {
+    Pipeline *pipeline = argument;
+    InputScanner *input = pipeline->input;
+    CommandBatch *batch = spsc_pop(&pipeline->free_batches);
+    reset_command_batch(batch);
+    char *line, *line_end;
+    while (scanner_next_line(input, &line, &line_end)) {
+        if (!input->mapped) {
+            // Il buffer dell'input viene riscritto dalle letture successive: la riga va copiata
+            size_t length = line_end - line;
+            if (batch->text_size + length > batch->text_capacity) {
+                if (batch->size > 0) {
+                    spsc_push(&pipeline->parsed, batch);
+                    batch = spsc_pop(&pipeline->free_batches);
+                    reset_command_batch(batch);
+                }
+                if (length > batch->text_capacity) {
+                    batch->text_capacity = length;
+                    batch->text = realloc(batch->text, length);
+                }
+            }
+            line = memcpy(batch->text + batch->text_size, line, length);
+            line_end = line + length;
+            batch->text_size += length;
         }
-    } else if (order == pending_orders_list.tail) {  // Nodo in coda
-        pending_orders_list.tail = order->prev;
-        if (pending_orders_list.tail != NULL) { // Se esiste un nodo in coda
-            pending_orders_list.tail->next = NULL;  // Imposta il prossimo nodo della nuova coda a NULL.
-        } else {
-            pending_orders_list.head = NULL;  // La lista diventa vuota
+        parse_command(line, line_end, &batch->commands[batch->size++]);
+
+        // Il gruppo parte quando è pieno o quando la prossima riga dovrebbe attendere nuovo input
+        if (batch->size == PIPELINE_BATCH_COMMANDS ||
+            (!input->mapped && memchr(input->data + input->pos, '\n', input->size - input->pos) == NULL)) {
+            spsc_push(&pipeline->parsed, batch);
+            batch = spsc_pop(&pipeline->free_batches);
+            reset_command_batch(batch);
         }
-    } else {  // Nodo in posizione intermedia
-        order->prev->next = order->next;
-        order->next->prev = order->prev;
     }
-    order->prev = order->next = NULL;
-    insert_ready_order_in_minheap(ready_orders_heap, order);
-
+    spsc_push(&pipeline->parsed, batch);
+    spsc_push(&pipeline->parsed, NULL);
+    return NULL;
 }
 
-// Esegue un ordine se è stato verificato con successo
-void make_order(OrderNode *order, MinHeap_orders *ready_orders_heap, Recipe *recipe) {
-
-    // Sottrai gli ingredienti dai lotti
-    IngredientNode *ingredient_array = recipe->ingredients;
-    for(int i=0; i<recipe->ingredients_size; i++) {
-        int total_required = ingredient_array[i].quantity * order->quantity;
-        Ingredient *ingredient = ingredientTable[ingredient_array[i].hash];
+// Thread di scrittura: scrive i blocchi nell'ordine in cui li ha prodotti il simulatore
+void *pipeline_writer(void *argument) {
+    Pipeline *pipeline = argument;
+    OutputBlock *block;
+    while ((block = spsc_pop(&pipeline->filled)) != NULL) {
+        write_all(pipeline->output_fd, block->data, block->size);
+        spsc_push(&pipeline->free_blocks, block);
+    }
+    return NULL;
+}
 
-        if (ingredient == NULL) {
-            return;
+// Come run_commands, con lettura e scrittura su thread separati. Al ritorno tutte le risposte sono scritte
+// e l'output torna a essere scritto direttamente.
+int run_pipeline(InputScanner *input, ReadyQueue *ready_orders, int courier_frequency, int courier_capacity,
+                 int tick, int courier_done_tick) {
+    Pipeline pipeline;
+    spsc_init(&pipeline.parsed, PIPELINE_RING_SIZE);
+    spsc_init(&pipeline.free_batches, PIPELINE_RING_SIZE);
+    spsc_init(&pipeline.filled, PIPELINE_RING_SIZE);
+    spsc_init(&pipeline.free_blocks, PIPELINE_RING_SIZE);
+    pipeline.input = input;
+    pipeline.output_fd = bakery->output.fd;
+    CommandBatch *batches = calloc(PIPELINE_BATCHES, sizeof(CommandBatch));
+    for (int i = 0; i < PIPELINE_BATCHES; i++) {
+        if (!input->mapped) {
+            batches[i].text_capacity = PIPELINE_BATCH_TEXT;
+            batches[i].text = malloc(PIPELINE_BATCH_TEXT);
         }
+        spsc_push(&pipeline.free_batches, &batches[i]);
+    }
+    OutputBlock *blocks = malloc(PIPELINE_BLOCKS * sizeof(OutputBlock));
+    for (int i = 0; i < PIPELINE_BLOCKS; i++) {
+        spsc_push(&pipeline.free_blocks, &blocks[i]);
+    }
 
-        // Sottrai la quantità dal totale disponibile dell'ingrediente
-        ingredient->total_quantity -= total_required;
-
-        // Sottrai la quantità dai lotti
-        MinHeap_lots *heap = ingredient->heap;
-        for (int j = 0; j < heap->size && total_required > 0; j++) {
-            if (heap->lots[j].quantity <= total_required) {
-                total_required -= heap->lots[j].quantity;
-                heap->lots[j].quantity = 0;  // Elimina il lotto
-            } else {
-                heap->lots[j].quantity -= total_required;
-                total_required = 0;
-            }
-
-            // Rimuovi i lotti esauriti (se la quantità è 0)
-            if (heap->lots[j].quantity == 0) {
-                remove_ingredient_lot(heap);
-                j--;
+    // Le risposte già prodotte escono prima di quelle della pipeline
+    output_flush();
+    pthread_t parser, writer;
+    bool writer_started = pthread_create(&writer, NULL, pipeline_writer, &pipeline) == 0;
+    bool parser_started = writer_started && pthread_create(&parser, NULL, pipeline_parser, &pipeline) == 0;
+    if (parser_started) {
+        bakery->output.pipeline = &pipeline;
+        bakery->output.block = spsc_pop(&pipeline.free_blocks);
+        bakery->output.data = bakery->output.block->data;
+
+        CommandBatch *batch;
+        while ((batch = spsc_pop(&pipeline.parsed)) != NULL) {
+            for (int i = 0; i < batch->size; i++) {
+                tick = step_command(&batch->commands[i], ready_orders, courier_frequency, courier_capacity,
+                                    tick, courier_done_tick);
             }
+            spsc_push(&pipeline.free_batches, batch);
         }
+        pthread_join(parser, NULL);
+        output_flush();
+        bakery->output.pipeline = NULL;
+        bakery->output.block = &bakery->output.own_block;
+        bakery->output.data = bakery->output.own_block.data;
+    }
+    if (writer_started) {
+        spsc_push(&pipeline.filled, NULL);
+        pthread_join(writer, NULL);
+    }
+    if (!parser_started) {
+        // Thread non disponibili: si procede senza pipeline
+        tick = run_commands(input, ready_orders, courier_frequency, courier_capacity, tick, courier_done_tick);
     }
 
-    // Ora l'ordine è pronto
-    move_order_to_minheap(order, ready_orders_heap);
+    for (int i = 0; i < PIPELINE_BATCHES; i++) {
+        for (int j = 0; j < PIPELINE_BATCH_COMMANDS; j++) {
+            free(batches[i].commands[j].items);
+        }
+        free(batches[i].text);
+    }
+    free(batches);
+    free(blocks);
+    spsc_free(&pipeline.parsed);
+    spsc_free(&pipeline.free_batches);
+    spsc_free(&pipeline.filled);
+    spsc_free(&pipeline.free_blocks);
+    return tick;
 }
 
-// Controlla se l'ordine può essere eseguito
-void check_order(OrderNode *current_order, MinHeap_orders *ready_orders_heap, int tick) {
+// ****____****____****____****____**** MODO SERVIZIO ****____****____****____****____****
 
-    Recipe *recipe = current_order->recipe;
-    // Verifica se ci sono abbastanza ingredienti per l'ordine
-    IngredientNode *ingredient_array = recipe->ingredients;
+// Con --servizio PATH la pasticceria resta in memoria e riceve comandi da più client su un socket Unix.
+// I thread di ricezione leggono le righe con epoll e le accodano al simulatore (il thread principale)
+// su una coda MPSC; il simulatore assegna i tick nell'ordine di arrivo e rimanda a ogni client le
+// risposte dei suoi comandi, corriere compreso se passa prima di uno di essi.
 
-    for(int i=0; i<recipe->ingredients_size; i++) {
-        int total_required = ingredient_array[i].quantity * current_order->quantity;
-        int total_available = 0;
-        unsigned int index = ingredient_array[i].hash;
+volatile sig_atomic_t server_stop_requested = 0;
+int server_wake_fd = -1;
 
-        if(index == INGREDIENT_TABLE_SIZE) {
-            // Cerca l'ingrediente nella hash table
-            index = search_ingredient(ingredient_array[i].name);
+// SIGINT e SIGTERM fermano il servizio: il simulatore viene svegliato e chiude in ordine
+void server_signal_handler(int signal_number) {
+    (void)signal_number;
+    server_stop_requested = 1;
+    eventfd_signal(server_wake_fd);
+}
 
-            if(index == INGREDIENT_TABLE_SIZE) {
-                return;
-            }
-            ingredient_array[i].hash = index;      //aggiorno hash di ingredient_node
-            free(ingredient_array[i].name);
-            ingredient_array[i].name = NULL;
+// Crea il socket in ascolto su path, sostituendo un socket rimasto da un'esecuzione precedente;
+// se path esiste ma non è un socket fallisce senza toccarlo
+int server_listen(const char *path) {
+    struct sockaddr_un address;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat existing;
+    if (lstat(path, &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode)) {
+            close(fd);
+            return -1;
         }
+        unlink(path);
+    }
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
 
-        Ingredient *ingredient = ingredientTable[index];
+// Aggiorna gli eventi attesi dal client: nuovi comandi finché non chiude, EPOLLOUT se ha risposte in sospeso
+void client_update_events(IntakeThread *intake, ServerClient *client) {
+    unsigned int events = (client->read_closed ? 0 : EPOLLIN | EPOLLRDHUP) |
+                          (client->output_sent < client->output.size ? EPOLLOUT : 0);
+    if (events != client->events) {
+        struct epoll_event event = {.events = events, .data.ptr = client};
+        epoll_ctl(intake->epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+        client->events = events;
+    }
+}
 
-        if (ingredient == NULL) {
-            return;
-        }
+// Chiude la connessione; il client viene liberato da intake_sweep quando non ha più comandi in sospeso
+void client_close(IntakeThread *intake, ServerClient *client) {
+    epoll_ctl(intake->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    client->fd = -1;
+    intake->closed_clients++;
+}
 
-        // Somma i lotti disponibili nel min-heap dell'ingrediente
-        int j = 0;
-        while (j < ingredient->heap->size && total_available < total_required) {
-            if (ingredient->heap->lots[j].expiration > tick) {
-                total_available += ingredient->heap->lots[j].quantity;
-                j++;
+// Libera i client chiusi senza comandi in sospeso (fuori dal giro di eventi che potrebbe ancora citarli);
+// con force all'arresto libera tutti i client, chiudendo quelli ancora aperti
+void intake_sweep(IntakeThread *intake, bool force) {
+    ServerClient **link = &intake->clients;
+    while ((intake->closed_clients > 0 || force) && *link != NULL) {
+        ServerClient *client = *link;
+        if ((client->fd < 0 && client->pending == 0) || force) {
+            if (client->fd >= 0) {
+                close(client->fd);
             } else {
-                ingredient->total_quantity -= ingredient->heap->lots[j].quantity;
-                remove_ingredient_lot(ingredient->heap);
+                intake->closed_clients--;
             }
+            *link = client->next;
+            free(client->input.data);
+            free(client->output.data);
+            free(client);
+        } else {
+            link = &client->next;
         }
+    }
+}
 
-        // Se la quantità richiesta non è disponibile, interrompi il controllo
-        if (total_available < total_required) {
-            recipe->last_tick_check = tick;                          //aggiorno il tick dell'ultimo fallimento
-            recipe->last_quantity_failed = current_order->quantity;  //aggiorno la quantità dell'ultimo fallimento
+// Invia le risposte accumulate; chiude il client che ha finito di inviare comandi e ha tutte le risposte
+void client_send(IntakeThread *intake, ServerClient *client) {
+    while (client->output_sent < client->output.size) {
+        ssize_t bytes = send(client->fd, client->output.data + client->output_sent,
+                             client->output.size - client->output_sent, MSG_NOSIGNAL);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                client_close(intake, client);
+                return;
+            }
+            break;
+        }
+        client->output_sent += bytes;
+    }
+    if (client->output_sent == client->output.size) {
+        client->output.size = 0;
+        client->output_sent = 0;
+        if (client->read_closed && client->pending == 0) {
+            client_close(intake, client);
             return;
         }
     }
+    client_update_events(intake, client);
+}
 
-    // Se l'ordine può essere eseguito, chiama make_order
-    make_order(current_order, ready_orders_heap, recipe);
+void intake_accept(IntakeThread *intake) {
+    while (true) {
+        int fd = accept(intake->server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            return;  // EAGAIN: nessun altro client in attesa, o accettato da un altro thread
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        ServerClient *client = calloc(1, sizeof(ServerClient));
+        client->fd = fd;
+        client->events = EPOLLIN | EPOLLRDHUP;
+        client->next = intake->clients;
+        intake->clients = client;
+        struct epoll_event event = {.events = client->events, .data.ptr = client};
+        epoll_ctl(intake->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
 }
 
-// Inserisci un nuovo ordine in coda, controlla se esiste la ricetta e assegna il peso
-void add_order(const char *recipe_name, int quantity, int tick, MinHeap_orders *ready_orders_heap) {
-    unsigned int index = search_recipe(recipe_name);
-    if (index == RECIPE_TABLE_SIZE) {
-        printf("rifiutato\n");
-        return;
+// Legge dal client e accoda al simulatore ogni riga completa; ritorna il numero di comandi accodati
+int intake_read(IntakeThread *intake, ServerClient *client) {
+    while (!client->read_closed) {
+        if (client->input.capacity - client->input.size < SERVER_READ_SIZE) {
+            client->input.capacity = client->input.size + SERVER_READ_SIZE;
+            client->input.data = realloc(client->input.data, client->input.capacity);
+        }
+        ssize_t bytes = recv(client->fd, client->input.data + client->input.size, SERVER_READ_SIZE, 0);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (bytes <= 0) {
+            client->read_closed = true;  // Le risposte ai comandi già ricevuti vengono comunque inviate
+            break;
+        }
+        client->input.size += bytes;
     }
-    Recipe *recipe = recipeTable[index];
 
-    OrderNode *newOrder = malloc(sizeof(OrderNode));
-    newOrder->recipe = recipe;
-    newOrder->quantity = quantity;
-    newOrder->tick = tick;
-    newOrder->next = NULL;
+    int pushed = 0;
+    char *start = client->input.data;
+    char *end = client->input.data + client->input.size;
+    while (start < end) {
+        char *newline = memchr(start, '\n', end - start);
+        if (newline == NULL) {
+            if (!client->read_closed) {
+                break;
+            }
+            newline = end;  // Come sull'input standard, l'ultima riga può mancare del '\n'
+        }
+        ServerRequest *request = malloc(sizeof(ServerRequest));
+        request->client = client;
+        request->intake = intake;
+        request->length = newline - start;
+        request->line = malloc(request->length + 1);
+        memcpy(request->line, start, request->length);
+        request->response = (ByteBuffer){NULL, 0, 0};
+        client->pending++;
+        mpsc_push(&intake->server->requests, &request->node);
+        pushed++;
+        start = newline == end ? end : newline + 1;
+    }
+    client->input.size = end - start;
+    memmove(client->input.data, start, client->input.size);
 
-    if (pending_orders_list.tail == NULL) {
-        // La lista è vuota
-        newOrder->prev = NULL;
-        pending_orders_list.head = newOrder;
-        pending_orders_list.tail = newOrder;
+    if (client->read_closed && client->pending == 0 && client->output.size == 0) {
+        client_close(intake, client);
     } else {
-        // Aggiungi in coda
-        newOrder->prev = pending_orders_list.tail;
-        pending_orders_list.tail->next = newOrder;
-        pending_orders_list.tail = newOrder;
+        client_update_events(intake, client);
     }
-    printf("accettato\n");
+    return pushed;
+}
 
-    // Se la ricetta con quantità minore o uguale è già fallita con lo scorso rifornimento non eseguo il check_order
-    if(newOrder->recipe->last_tick_check >= last_supply_tick && newOrder->quantity >= newOrder->recipe->last_quantity_failed) {
-        return;
+// Consegna ai client le risposte pronte
+void intake_complete(IntakeThread *intake) {
+    MpscNode *node;
+    while ((node = mpsc_pop(&intake->completions)) != NULL) {
+        ServerRequest *request = (ServerRequest *)node;
+        ServerClient *client = request->client;
+        client->pending--;
+        if (client->fd >= 0) {
+            // Le risposte di un client chiuso vengono scartate
+            byte_buffer_append(&client->output, request->response.data, request->response.size);
+            client_send(intake, client);
+        }
+        free(request->response.data);
+        free(request->line);
+        free(request);
     }
-    check_order(newOrder, ready_orders_heap, tick);
 }
 
-// Controlla la lista degli ordini in attesa e verifica se possono essere eseguiti
-void check_orders(MinHeap_orders *ready_orders_heap, int tick) {
-    OrderNode *current_order = pending_orders_list.head;
-    //int i = 0;
-    // Scorri la lista degli ordini in attesa
-    while (current_order != NULL) {
-        OrderNode *next_order = current_order->next;
-
-        //non controllare la ricetta se la quantità dell'ordine è maggiore o uguale all'ultima quantità fallita e il tick nella ricetta è quello corrente
-        if(current_order->recipe->last_quantity_failed > current_order->quantity || tick != current_order->recipe->last_tick_check) {
-
-            bool order_can_be_made = true;
-            // Verifica se ci sono abbastanza ingredienti per l'ordine
-            IngredientNode *ingredient_array = current_order->recipe->ingredients;
-            for(int i=0; i<current_order->recipe->ingredients_size; i++) {
-                int total_required = ingredient_array[i].quantity * current_order->quantity;
-                unsigned int index = ingredient_array[i].hash;
-
-                if(index == INGREDIENT_TABLE_SIZE) {
-                    // Cerca l'ingrediente nella hash table
-                    index = search_ingredient(ingredient_array[i].name);
-                    if(index == INGREDIENT_TABLE_SIZE) {
-                        break; // l'ingrediente non esiste nella hash table ingredienti
+void *intake_main(void *argument) {
+    IntakeThread *intake = argument;
+    Server *server = intake->server;
+    struct epoll_event events[SERVER_EVENTS];
+    while (!__atomic_load_n(&server->stop, __ATOMIC_ACQUIRE)) {
+        int count = epoll_wait(intake->epoll_fd, events, SERVER_EVENTS, -1);
+        int pushed = 0;
+        for (int i = 0; i < count; i++) {
+            void *source = events[i].data.ptr;
+            if (source == &server->listen_fd) {
+                intake_accept(intake);
+            } else if (source == &intake->wake_fd) {
+                unsigned long long value;
+                ssize_t ignored = read(intake->wake_fd, &value, sizeof(value));
+                (void)ignored;
+                intake_complete(intake);
+            } else {
+                ServerClient *client = source;
+                if (client->fd < 0) {
+                    continue;  // Chiuso da un evento precedente dello stesso giro
+                }
+                if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                    // Connessione persa: i comandi già nel buffer del socket vengono eseguiti, le risposte scartate
+                    pushed += intake_read(intake, client);
+                    if (client->fd >= 0) {
+                        client_close(intake, client);
                     }
-                    ingredient_array[i].hash = index;      //aggiorno hash di ingredient_node
-                    free(ingredient_array[i].name);
-                    ingredient_array[i].name = NULL;
+                    continue;
                 }
-
-                Ingredient *ingredient = ingredientTable[index];
-
-                if (ingredient == NULL) {
-                    order_can_be_made = false;
-                    break;
+                if (events[i].events & EPOLLOUT) {
+                    client_send(intake, client);
                 }
-
-                if(ingredient->total_quantity < total_required) {
-                    order_can_be_made = false;
-                    break;
+                if (client->fd >= 0 && (events[i].events & (EPOLLIN | EPOLLRDHUP))) {
+                    pushed += intake_read(intake, client);
                 }
             }
-            // Se l'ordine può essere eseguito, chiama make_order
-            if (order_can_be_made) {
-                make_order(current_order, ready_orders_heap, current_order->recipe);
-            }
-            else {
-                current_order->recipe->last_tick_check = tick;
-                current_order->recipe->last_quantity_failed = current_order->quantity;
-            }
         }
-        current_order = next_order;
+        if (pushed > 0) {
+            eventfd_signal(server->wake_fd);
+        }
+        intake_sweep(intake, false);
     }
+    intake_sweep(intake, true);
+    return NULL;
 }
 
-void free_all_memory() {
+// Libera le richieste rimaste in una coda all'arresto
+void server_drain(MpscQueue *queue) {
+    MpscNode *node;
+    while ((node = mpsc_pop(queue)) != NULL) {
+        ServerRequest *request = (ServerRequest *)node;
+        free(request->response.data);
+        free(request->line);
+        free(request);
+    }
+}
 
-    int i = 0;
-    for (i = 0; i < INGREDIENT_TABLE_SIZE; i++) {
-        if(ingredientTable[i] != NULL) {
-            free(ingredientTable[i]->heap->lots);
-            free(ingredientTable[i]->heap);
-            free(ingredientTable[i]->name);
-            free(ingredientTable[i]);
+// Esegue i comandi dei client da tick fino a SIGINT o SIGTERM; ritorna il tick successivo all'ultimo
+// comando, o -1 se il socket non può essere aperto
+int run_server(const char *path, int intake_count, ReadyQueue *ready_orders, int courier_frequency,
+               int courier_capacity, int tick, int courier_done_tick) {
+    Server server;
+    server.listen_fd = server_listen(path);
+    if (server.listen_fd < 0) {
+        return -1;
+    }
+    server.wake_fd = eventfd(0, EFD_CLOEXEC);
+    server.stop = 0;
+    server.intake_count = intake_count;
+    server.intakes = calloc(intake_count, sizeof(IntakeThread));
+    mpsc_init(&server.requests);
+
+    server_wake_fd = server.wake_fd;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = server_signal_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    int started = 0;
+    while (started < intake_count) {
+        IntakeThread *intake = &server.intakes[started];
+        intake->server = &server;
+        intake->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        intake->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        mpsc_init(&intake->completions);
+        // Con EPOLLEXCLUSIVE una nuova connessione sveglia uno solo dei thread in attesa
+        struct epoll_event listen_event = {.events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = &server.listen_fd};
+        struct epoll_event wake_event = {.events = EPOLLIN, .data.ptr = &intake->wake_fd};
+        epoll_ctl(intake->epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &listen_event);
+        epoll_ctl(intake->epoll_fd, EPOLL_CTL_ADD, intake->wake_fd, &wake_event);
+        if (pthread_create(&intake->thread, NULL, intake_main, intake) != 0) {
+            close(intake->epoll_fd);
+            close(intake->wake_fd);
+            break;
         }
+        started++;
     }
 
-    for (i = 0; i < RECIPE_TABLE_SIZE; i++) {
-        if(recipeTable[i] != NULL) {
-            IngredientNode *ingredient_array = recipeTable[i]->ingredients;
-            for(int j=0; j<recipeTable[i]->ingredients_size; j++) {
-                if(ingredient_array[j].name!=NULL) {
-                    free(ingredient_array[j].name);
-                }
-            }
-            free(recipeTable[i]->ingredients);
-            free(recipeTable[i]->name);
-            free(recipeTable[i]);
+    output_flush();
+    Command command = {0};
+    ServerRequest **done = malloc(SERVER_BATCH * sizeof(ServerRequest *));
+    while (started > 0 && !server_stop_requested) {
+        int count = 0;
+        MpscNode *node;
+        while (count < SERVER_BATCH && (node = mpsc_pop(&server.requests)) != NULL) {
+            ServerRequest *request = (ServerRequest *)node;
+            parse_command(request->line, request->line + request->length, &command);
+            bakery->output.capture = &request->response;
+            tick = step_command(&command, ready_orders, courier_frequency, courier_capacity, tick, courier_done_tick);
+            output_flush();
+            bakery->output.capture = NULL;
+            done[count++] = request;
         }
-    }
-    // Ora liberiamo la pending order list
-    while(pending_orders_list.head != NULL) {
-        // se la testa è uguale alla coda
-        if(pending_orders_list.tail == pending_orders_list.head){
-            free(pending_orders_list.tail);
-            pending_orders_list.head = NULL;
-            pending_orders_list.tail = NULL;
+        if (count == 0) {
+            // Coda vuota: si attende che un thread di ricezione accodi altri comandi
+            unsigned long long value;
+            ssize_t ignored = read(server.wake_fd, &value, sizeof(value));
+            (void)ignored;
+            continue;
+        }
+        // Un solo fdatasync del giornale per tutto il gruppo, prima di qualsiasi risposta
+        journal_sync();
+        for (int i = 0; i < count; i++) {
+            // Dopo l'inserimento la richiesta appartiene al thread di ricezione, che può già liberarla
+            IntakeThread *intake = done[i]->intake;
+            intake->notify = true;
+            mpsc_push(&intake->completions, &done[i]->node);
         }
-        else {
-            OrderNode *temp = pending_orders_list.tail;
-            pending_orders_list.tail = pending_orders_list.tail->prev;
-            free(temp);
-            temp = NULL;
+        for (int i = 0; i < started; i++) {
+            if (server.intakes[i].notify) {
+                server.intakes[i].notify = false;
+                eventfd_signal(server.intakes[i].wake_fd);
+            }
         }
     }
-    free(orders_to_load.head);
-    free(orders_to_load.tail);
+
+    __atomic_store_n(&server.stop, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < started; i++) {
+        eventfd_signal(server.intakes[i].wake_fd);
+    }
+    for (int i = 0; i < started; i++) {
+        IntakeThread *intake = &server.intakes[i];
+        pthread_join(intake->thread, NULL);
+        server_drain(&intake->completions);
+        close(intake->epoll_fd);
+        close(intake->wake_fd);
+    }
+    server_drain(&server.requests);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    server_wake_fd = -1;
+    close(server.wake_fd);
+    close(server.listen_fd);
+    unlink(path);
+    free(done);
+    free(command.items);
+    free(server.intakes);
+    return tick;
 }
 
-int main(){
-    char *line = NULL;  // Buffer dinamico per la riga
-    size_t len = 0;
-    int courier_frequency, courier_capacity;
-    int tick = 0;
-    MinHeap_orders *ready_orders_heap = NULL;
-    ready_orders_heap = create_minheap_orders(25);
+// ****____****____****____****____**** ESECUZIONE A LOTTI ****____****____****____****____****
 
-    //printf("Hello World\n");
-    FILE* file = stdin;
-    if (file == NULL) {
-        printf("Errore: impossibile aprire il file.\n");
-        return 1;
-    }
+// Con --lotto ogni file indicato è una simulazione indipendente con le risposte in FILE.out.
+// Ogni thread ha la propria pasticceria, riusata da un file all'altro.
 
-    // Leggi la prima riga dal file
-    if (getline(&line, &len, file) == -1) {
-        printf("Errore durante la lettura della riga dal file\n");
-        fclose(file);
-        free(line);  // Rilascia il buffer
-        return 1;
+// Prossimo file per il thread index: dalla testa della propria coda, altrimenti rubato dal fondo
+// di un'altra (-1 se tutte le code sono vuote)
+int batch_next_file(BatchRun *run, int index) {
+    for (int k = 0; k < run->workers; k++) {
+        WorkQueue *queue = &run->queues[(index + k) % run->workers];
+        int file = -1;
+        pthread_mutex_lock(&queue->lock);
+        if (queue->head < queue->tail) {
+            file = k == 0 ? queue->files[queue->head++] : queue->files[--queue->tail];
+        }
+        pthread_mutex_unlock(&queue->lock);
+        if (file >= 0) {
+            return file;
+        }
     }
+    return -1;
+}
 
-    // Estrai i due numeri dalla stringa letta
-    if (sscanf(line, "%d %d", &courier_frequency, &courier_capacity) != 2) {
-        printf("Errore durante la lettura dei valori dalla prima riga\n");
-        fclose(file);
-        return 1;
+// Simula un file con la pasticceria del thread corrente, ripulita, scrivendo le risposte in path.out
+bool run_batch_file(const char *path, ReadyQueue *ready_orders) {
+    int input_fd = open(path, O_RDONLY);
+    if (input_fd < 0) {
+        return false;
+    }
+    size_t length = strlen(path);
+    char *output_path = malloc(length + sizeof(".out"));
+    memcpy(output_path, path, length);
+    strcpy(output_path + length, ".out");
+    int output_fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    free(output_path);
+    if (output_fd < 0) {
+        close(input_fd);
+        return false;
     }
 
-    // Leggi il file riga per riga
-    while (getline(&line, &len, file) != -1) {
-
-        // Verifichiamo se è l'ora dello sbusto
-        if(tick % courier_frequency == 0 && tick != 0){
-            // Esegui la funzione load_courier
-            load_courier(courier_capacity, ready_orders_heap);
+    reset_bakery();
+    reset_ready_queue(ready_orders);
+    bakery->output.fd = output_fd;
+    InputScanner input;
+    scanner_open(&input, input_fd);
+    char *line, *line_end;
+    int courier_frequency, courier_capacity;
+    bool ok = scanner_next_line(&input, &line, &line_end) && scan_int(&line, line_end, &courier_frequency) &&
+              scan_int(&line, line_end, &courier_capacity);
+    if (ok) {
+        int tick = run_commands(&input, ready_orders, courier_frequency, courier_capacity, 0, -1);
+        if (tick % courier_frequency == 0 && tick != 0) {
+            load_courier(courier_capacity, ready_orders);
         }
+    }
+    output_flush();
+    scanner_close(&input);
+    close(input_fd);
+    return close(output_fd) == 0 && ok;
+}
 
-        // Ottieni il comando (es. "aggiungi_ricetta", "rimuovi_ricetta", "rifornimento", "ordine")
-        char *command = strtok(line, " ");
+void *batch_worker(void *argument) {
+    BatchWorker *worker = argument;
+    Bakery *own_bakery = malloc(sizeof(Bakery));
+    init_bakery(own_bakery, -1);
+    bakery = own_bakery;
+    ReadyQueue *ready_orders = create_ready_queue();
+
+    int file;
+    while ((file = batch_next_file(worker->run, worker->index)) >= 0) {
+        if (!run_batch_file(worker->run->paths[file], ready_orders)) {
+            char message[512];
+            snprintf(message, sizeof(message), "Errore durante l'elaborazione di %s\n", worker->run->paths[file]);
+            report_error(message);
+            __atomic_add_fetch(&worker->run->failures, 1, __ATOMIC_RELAXED);
+        }
+    }
 
-        if (strcmp(command, "aggiungi_ricetta") == 0) {
+    free_ready_queue(ready_orders);
+    free_all_memory();
+    free(own_bakery);
+    bakery = NULL;
+    STAT_MERGE();
+    return NULL;
+}
 
-            // Leggi il nome della ricetta
-            char *recipe_name = strtok(NULL, " ");
+// Ordina i file dal più grande al più piccolo
+int compare_batch_files(const void *a, const void *b) {
+    off_t size_a = ((const BatchFile *)a)->size, size_b = ((const BatchFile *)b)->size;
+    return size_a < size_b ? 1 : (size_a > size_b ? -1 : 0);
+}
 
-            // Leggi il resto della linea (ingredienti e quantità)
-            char *rest_of_line = strtok(NULL, "\n");
+// Simula count file su workers thread, ritorna il numero di file non elaborati
+int run_batch(char **paths, int count, int workers) {
+    if (workers > count) {
+        workers = count;
+    }
+    if (workers < 1) {
+        workers = 1;
+    }
+    // I file più grandi partono per primi e sono distribuiti a turno, così le code sono bilanciate
+    BatchFile *files = malloc(count * sizeof(BatchFile));
+    for (int i = 0; i < count; i++) {
+        struct stat info;
+        files[i].size = stat(paths[i], &info) == 0 ? info.st_size : 0;
+        files[i].index = i;
+    }
+    qsort(files, count, sizeof(BatchFile), compare_batch_files);
+
+    BatchRun run = {paths, malloc(workers * sizeof(WorkQueue)), workers, 0};
+    for (int w = 0; w < workers; w++) {
+        run.queues[w].files = malloc(((count + workers - 1) / workers) * sizeof(int));
+        run.queues[w].head = 0;
+        run.queues[w].tail = 0;
+        pthread_mutex_init(&run.queues[w].lock, NULL);
+    }
+    for (int i = 0; i < count; i++) {
+        WorkQueue *queue = &run.queues[i % workers];
+        queue->files[queue->tail++] = files[i].index;
+    }
+    free(files);
+
+    pthread_t *threads = malloc(workers * sizeof(pthread_t));
+    BatchWorker *arguments = malloc(workers * sizeof(BatchWorker));
+    int started = 0;
+    for (int w = 0; w < workers; w++) {
+        arguments[w].run = &run;
+        arguments[w].index = w;
+        if (pthread_create(&threads[started], NULL, batch_worker, &arguments[w]) == 0) {
+            started++;
+        }
+    }
+    if (started == 0) {
+        // Nessun thread disponibile: il lavoro viene rubato tutto dal thread principale
+        Bakery *main_thread_bakery = bakery;
+        batch_worker(&arguments[0]);
+        bakery = main_thread_bakery;
+    }
+    for (int w = 0; w < started; w++) {
+        pthread_join(threads[w], NULL);
+    }
 
-            // Aggiungi la ricetta con il nome e il resto della linea
-            add_recipe(recipe_name, rest_of_line);
+    for (int w = 0; w < workers; w++) {
+        pthread_mutex_destroy(&run.queues[w].lock);
+        free(run.queues[w].files);
+    }
+    free(run.queues);
+    free(threads);
+    free(arguments);
+    return run.failures;
+}
 
-        } else if (strcmp(command, "rimuovi_ricetta") == 0) {
-            // Leggi il nome della ricetta da rimuovere
-            char *recipe_name = strtok(NULL, "\n");
-            remove_recipe(recipe_name, ready_orders_heap);
+int main(int argc, char *argv[]){
+    char *line, *line_end;
+    int courier_frequency, courier_capacity;
+    int tick = 0;
+    ReadyQueue *ready_orders = create_ready_queue();
+    const char *snapshot_load_path = NULL;  // --carica-stato: riparte dallo stato salvato
+    const char *snapshot_save_path = NULL;  // --salva-stato: salva lo stato a fine input
+    const char *journal_path = NULL;        // --giornale: registra i comandi e riparte da quelli registrati
+    int courier_done_tick = -1;             // Tick il cui corriere è già passato prima della ripresa
+    char **batch_paths = NULL;              // --lotto: file da simulare in parallelo
+    int batch_count = 0;
+    long batch_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool threads_given = false;
+    bool use_pipeline = false;              // --pipeline: lettura, simulazione e scrittura su thread separati
+    const char *server_path = NULL;         // --servizio: dopo l'input resta in ascolto su un socket Unix
+
+    init_bakery(&main_bakery, STDOUT_FILENO);
+
+    // Con un terminale, o con --flush, ogni risposta viene scritta subito
+    bakery->output.flush_each_command = isatty(STDOUT_FILENO);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--flush") == 0) {
+            bakery->output.flush_each_command = true;
+        } else if (strcmp(argv[i], "--carica-stato") == 0 && i + 1 < argc) {
+            snapshot_load_path = argv[++i];
+        } else if (strcmp(argv[i], "--salva-stato") == 0 && i + 1 < argc) {
+            snapshot_save_path = argv[++i];
+        } else if (strcmp(argv[i], "--giornale") == 0 && i + 1 < argc) {
+            journal_path = argv[++i];
+        } else if (strcmp(argv[i], "--compatta-ogni") == 0 && i + 1 < argc) {
+            journal.compaction_interval = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--servizio") == 0 && i + 1 < argc) {
+            server_path = argv[++i];
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            use_pipeline = true;
+        } else if (strcmp(argv[i], "--max-memory") == 0 && i + 1 < argc) {
+            memory_limit = parse_size(argv[++i]);
+            if (memory_limit == 0) {
+                report_error("Valore non valido per --max-memory\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--thread") == 0 && i + 1 < argc) {
+            batch_threads = strtol(argv[++i], NULL, 10);
+            threads_given = true;
+        } else if (strcmp(argv[i], "--lotto") == 0) {
+            // Tutti gli argomenti successivi sono file di input
+            batch_paths = argv + i + 1;
+            batch_count = argc - i - 1;
+            break;
+        }
+    }
+    atexit(output_flush);
+    select_stock_kernel();
+    STAT_INSTALL();
+
+    if (batch_paths != NULL) {
+        free_ready_queue(ready_orders);
+        if (journal_path != NULL || snapshot_load_path != NULL || snapshot_save_path != NULL) {
+            report_error("Il modo a lotti non supporta giornale e snapshot\n");
+            return 1;
+        }
+        return run_batch(batch_paths, batch_count, batch_threads > INT_MAX ? INT_MAX : (int)batch_threads) == 0 ? 0 : 1;
+    }
 
-        } else if (strcmp(command, "rifornimento") == 0) {
-            // Rimuovi i lotti scaduti
-            remove_expired_lots(tick);
-            // Leggi gli ingredienti e le quantità/scadenze
-            last_supply_tick = tick;
-            char *ingredient_name = strtok(NULL, " ");
-            while (ingredient_name != NULL) {
-                // Leggi quantità e scadenza
-                int quantity = string_to_int(strtok(NULL, " "));
-                int expiration = string_to_int(strtok(NULL, " "));
+    InputScanner input;
+    scanner_open(&input, STDIN_FILENO);
+
+    bool recovered = false;
+    off_t journal_length = 0;
+    if (journal_path != NULL) {
+        // Se il giornale esiste si riparte dal suo stato: l'input contiene solo i comandi successivi
+        journal.path = journal_path;
+        if (snapshot_load_path != NULL ||
+            !journal_recover(ready_orders, &courier_frequency, &courier_capacity, &tick,
+                             &recovered, &journal_length, &courier_done_tick)) {
+            report_error("Errore durante il ripristino dal giornale\n");
+            scanner_close(&input);
+            free_ready_queue(ready_orders);
+            free_all_memory();
+            return 1;
+        }
+    } else if (snapshot_load_path != NULL) {
+        // Frequenza, capienza e tick vengono dallo snapshot: l'input contiene solo i comandi successivi
+        if (!load_snapshot(snapshot_load_path, ready_orders, &courier_frequency, &courier_capacity, &tick)) {
+            report_error("Errore durante la lettura dello snapshot\n");
+            scanner_close(&input);
+            free_ready_queue(ready_orders);
+            free_all_memory();
+            return 1;
+        }
+        recovered = true;
+    }
+    if (!recovered) {
+        // Leggi la prima riga dal file
+        if (!scanner_next_line(&input, &line, &line_end)) {
+            output_text("Errore durante la lettura della riga dal file\n");
+            scanner_close(&input);
+            return 1;
+        }
 
-                // Aggiungi l'ingrediente con la quantità e la scadenza solo se la scadenza non è immediata e la quantità è >0
-                if (expiration > tick && quantity > 0) {
-                    add_ingredient(ingredient_name, quantity, expiration);
-                }
+        // Estrai i due numeri dalla stringa letta
+        if (!scan_int(&line, line_end, &courier_frequency) || !scan_int(&line, line_end, &courier_capacity)) {
+            output_text("Errore durante la lettura dei valori dalla prima riga\n");
+            scanner_close(&input);
+            return 1;
+        }
+    }
 
-                // Leggi il prossimo ingrediente
-                ingredient_name = strtok(NULL, " ");
-            }
-            printf("rifornito\n");
-            check_orders(ready_orders_heap, tick);
+    if (journal_path != NULL) {
+        if (!journal_open(journal_path, journal_length)) {
+            report_error("Errore durante l'apertura del giornale\n");
+            scanner_close(&input);
+            free_ready_queue(ready_orders);
+            free_all_memory();
+            return 1;
+        }
+        if (journal_length == 0) {
+            journal_write_header(courier_frequency, courier_capacity, tick);
+        }
+    }
 
-        } else if (strcmp(command, "ordine") == 0) {
-            // Leggi il nome della ricetta e la quantità ordinata
-            char *recipe_name = strtok(NULL, " ");
-            int quantity = string_to_int(strtok(NULL, " "));
-            add_order(recipe_name, quantity, tick, ready_orders_heap);
+    if (use_pipeline) {
+        tick = run_pipeline(&input, ready_orders, courier_frequency, courier_capacity, tick, courier_done_tick);
+    } else {
+        tick = run_commands(&input, ready_orders, courier_frequency, courier_capacity, tick, courier_done_tick);
+    }
 
+    if (server_path != NULL) {
+        // Un solo thread di ricezione basta a meno di --thread esplicito
+        int intake_count = threads_given && batch_threads > 1 ? (batch_threads > 64 ? 64 : (int)batch_threads) : 1;
+        int server_tick = run_server(server_path, intake_count, ready_orders, courier_frequency, courier_capacity,
+                                     tick, courier_done_tick);
+        if (server_tick < 0) {
+            report_error("Errore durante l'apertura del socket del servizio\n");
+            server_path = NULL;  // Il servizio non è partito: l'input standard si chiude come senza --servizio
         } else {
-            printf("#Comando non riconosciuto: %s\n", command);
+            tick = server_tick;
         }
-        tick++;
-    }
-
-    // Se il prossimo istante dopo la fine del file arriva il corriere si sbusta
-    if(tick % courier_frequency == 0 && tick != 0){
-        load_courier(courier_capacity, ready_orders_heap);
     }
 
-    fclose(file);
-    free(line);
-    // Libero ready_orders_heap
-    if(ready_orders_heap != NULL) {
-        for(int i = 0; i < ready_orders_heap->size; i++) {
-            if(ready_orders_heap->orders[i] != NULL){
-                free(ready_orders_heap->orders[i]);
-                ready_orders_heap->orders[i] = NULL;
-            }
+    if (snapshot_save_path != NULL) {
+        // Il corriere di questo tick passerà alla ripresa, prima del primo comando successivo
+        if (!save_snapshot(snapshot_save_path, ready_orders, courier_frequency, courier_capacity, tick)) {
+            report_error("Errore durante il salvataggio dello snapshot\n");
         }
-        free(ready_orders_heap->orders);
-        free(ready_orders_heap);
+    } else if(server_path == NULL && tick % courier_frequency == 0 && tick != 0 && tick != courier_done_tick){
+        // Se il prossimo istante dopo la fine del file arriva il corriere si sbusta
+        load_courier(courier_capacity, ready_orders);
+        journal_append_courier();
     }
+    journal_close();
+    if (memory_limit != 0) {
+        memory_report(ready_orders);
+    }
+
+    scanner_close(&input);
+    // Libero la coda degli ordini pronti
+    free_ready_queue(ready_orders);
     free_all_memory();
     return 0;
  }
@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+"""Benchmark del simulatore della pasticceria.
+
+Misura, per ogni file di comandi:
+  * throughput: tempo di esecuzione migliore su piu' ripetizioni, comandi al secondo, picco di RSS;
+  * latenza per tipo di comando (--latenza): il binario gira con --flush e riceve un comando
+    alla volta; i tick in cui passa il corriere sono conteggiati come "corriere" (il tempo
+    include anche il comando di quel tick). Serve un binario che supporti --flush, per questo
+    la latenza e' misurata solo sul primo binario.
+
+Con --confronta esegue anche un secondo binario, verifica che l'output sia identico e
+riporta il rapporto tra i tempi.
+
+Esempio:
+  tools/benchmark.py ./main carico.txt --confronta ./main_vecchio --latenza
+"""
+import argparse
+import hashlib
+import os
+import subprocess
+import sys
+import time
+
+RESPONSES = {
+    b"aggiunta", b"ignorato", b"rimossa", b"ordini in sospeso", b"non presente",
+    b"rifornito", b"accettato", b"rifiutato",
+}
+TYPES = ["aggiungi_ricetta", "rimuovi_ricetta", "rifornimento", "ordine", "corriere"]
+PERCENTILES = [50, 90, 99, 99.9]
+
+
+def run_once(binary, path):
+    """Esegue il binario su un file, ritorna (secondi, picco RSS in KiB, md5 dell'output)."""
+    digest = hashlib.md5()
+    with open(path, "rb") as stdin:
+        start = time.perf_counter()
+        process = subprocess.Popen([binary], stdin=stdin, stdout=subprocess.PIPE)
+        for chunk in iter(lambda: process.stdout.read(1 << 16), b""):
+            digest.update(chunk)
+        _, status, usage = os.wait4(process.pid, 0)
+        elapsed = time.perf_counter() - start
+    process.returncode = os.waitstatus_to_exitcode(status)
+    if process.returncode != 0:
+        sys.exit("%s terminato con codice %d su %s" % (binary, process.returncode, path))
+    return elapsed, usage.ru_maxrss, digest.hexdigest()
+
+
+def throughput(binary, path, repetitions):
+    runs = [run_once(binary, path) for _ in range(repetitions)]
+    return min(r[0] for r in runs), max(r[1] for r in runs), runs[0][2]
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0.0
+    index = min(len(sorted_values) - 1, int(round(p / 100.0 * (len(sorted_values) - 1))))
+    return sorted_values[index]
+
+
+def latency(binary, path, limit):
+    """Invia un comando alla volta e misura il tempo fino alla sua risposta, in microsecondi."""
+    samples = {t: [] for t in TYPES}
+    with open(path, "rb") as f:
+        header = f.readline()
+        frequency = int(header.split()[0])
+        process = subprocess.Popen([binary, "--flush"], stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+        process.stdin.write(header)
+        process.stdin.flush()
+        for tick, line in enumerate(f):
+            if tick >= limit:
+                break
+            kind = "corriere" if tick > 0 and tick % frequency == 0 else line.split(b" ", 1)[0].strip()
+            if isinstance(kind, bytes):
+                kind = kind.decode()
+            start = time.perf_counter_ns()
+            process.stdin.write(line)
+            process.stdin.flush()
+            # Le righe del corriere precedono la risposta del comando
+            while process.stdout.readline().rstrip(b"\n") not in RESPONSES:
+                pass
+            samples.setdefault(kind, []).append((time.perf_counter_ns() - start) / 1000.0)
+        process.stdin.close()
+        process.stdout.read()
+        process.wait()
+    return samples
+
+
+def print_latency(name, samples):
+    print("  latenza %s (us)" % name)
+    print("    %-18s %9s" % ("comando", "numero") + "".join("%10s" % ("p%g" % p) for p in PERCENTILES) + "%10s" % "max")
+    for kind in TYPES:
+        values = sorted(samples.get(kind, []))
+        if not values:
+            continue
+        print("    %-18s %9d" % (kind, len(values))
+              + "".join("%10.1f" % percentile(values, p) for p in PERCENTILES) + "%10.1f" % values[-1])
+
+
+def count_commands(path):
+    with open(path, "rb") as f:
+        return max(0, sum(1 for _ in f) - 1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark del simulatore della pasticceria")
+    parser.add_argument("binario")
+    parser.add_argument("file", nargs="+", help="file di comandi (ad esempio prodotti da tools/generatore)")
+    parser.add_argument("--confronta", metavar="BINARIO", help="secondo binario da confrontare")
+    parser.add_argument("--ripetizioni", type=int, default=3)
+    parser.add_argument("--latenza", action="store_true", help="misura la latenza per comando")
+    parser.add_argument("--latenza-max", type=int, default=200000, help="comandi inviati nella misura di latenza")
+    args = parser.parse_args()
+
+    binaries = [args.binario] + ([args.confronta] if args.confronta else [])
+    failed = False
+    for path in args.file:
+        commands = count_commands(path)
+        print("%s: %d comandi" % (path, commands))
+        results = []
+        for i, binary in enumerate(binaries):
+            seconds, rss, digest = throughput(binary, path, args.ripetizioni)
+            results.append((seconds, digest))
+            print("  %-30s %9.3f s %12.0f comandi/s %10.1f MiB RSS"
+                  % (binary, seconds, commands / seconds if seconds > 0 else 0, rss / 1024.0))
+            if args.latenza and i == 0:
+                print_latency(binary, latency(binary, path, args.latenza_max))
+        if len(results) == 2:
+            if results[0][1] != results[1][1]:
+                print("  ATTENZIONE: output diversi")
+                failed = True
+            print("  rapporto %s / %s: %.2fx" % (binaries[1], binaries[0], results[1][0] / results[0][0]))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
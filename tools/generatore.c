@@ -0,0 +1,319 @@
+//
+// Generatore di carichi sintetici per il simulatore della pasticceria.
+// Produce su stdout un flusso di comandi valido e riproducibile a partire da un seed.
+//
+// Uso: generatore [profilo] [parametro=valore ...]
+//   profili: misto (default), catalogo, attesa, lotti, corriere
+//   esempio: generatore attesa seed=7 comandi=500000 ricette=50
+// Compilazione: gcc -O2 -std=gnu11 -o generatore tools/generatore.c -lm
+//
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ****____****____****____****____**** PARAMETRI ****____****____****____****____****
+
+typedef struct {
+    unsigned long long seed;
+    long commands;          // Comandi generati dopo l'intestazione
+    int courier_frequency;
+    int courier_capacity;
+    int recipes;            // Nomi di ricetta distinti
+    int ingredients;        // Nomi di ingrediente distinti
+    int name_min, name_max; // Lunghezza dei nomi (prefisso escluso)
+    int recipe_min_ingredients, recipe_max_ingredients;
+    int recipe_min_quantity, recipe_max_quantity;
+    int lots_min, lots_max;               // Lotti per rifornimento
+    int lot_min_quantity, lot_max_quantity;
+    int expiration_min, expiration_max;   // Scadenza relativa al tick corrente
+    int order_min, order_max;             // Elementi per ordine
+    double recipe_skew;     // >1 concentra ordini e rimozioni sulle prime ricette
+    bool initial_catalog;   // Aggiunge tutte le ricette prima degli altri comandi
+    int weight_add, weight_remove, weight_supply, weight_order;  // Pesi relativi dei comandi
+} Parameters;
+
+// Profilo misto: tutti i comandi con dimensioni moderate
+void preset_mixed(Parameters *p) {
+    *p = (Parameters){
+        .seed = 1, .commands = 100000, .courier_frequency = 100, .courier_capacity = 50000,
+        .recipes = 200, .ingredients = 300, .name_min = 4, .name_max = 20,
+        .recipe_min_ingredients = 1, .recipe_max_ingredients = 8,
+        .recipe_min_quantity = 1, .recipe_max_quantity = 100,
+        .lots_min = 1, .lots_max = 6, .lot_min_quantity = 1, .lot_max_quantity = 1000,
+        .expiration_min = 1, .expiration_max = 2000, .order_min = 1, .order_max = 20,
+        .recipe_skew = 1.0, .initial_catalog = true,
+        .weight_add = 5, .weight_remove = 3, .weight_supply = 20, .weight_order = 72,
+    };
+}
+
+// Parametro modificabile da riga di comando
+typedef struct {
+    const char *name;
+    char type;     // 'u' seed, 'l' long, 'i' int, 'd' double, 'b' bool
+    size_t offset;
+} ParameterField;
+
+#define FIELD(name, type, member) {name, type, offsetof(Parameters, member)}
+
+const ParameterField fields[] = {
+    FIELD("seed", 'u', seed), FIELD("comandi", 'l', commands),
+    FIELD("frequenza", 'i', courier_frequency), FIELD("capienza", 'i', courier_capacity),
+    FIELD("ricette", 'i', recipes), FIELD("ingredienti", 'i', ingredients),
+    FIELD("nome_min", 'i', name_min), FIELD("nome_max", 'i', name_max),
+    FIELD("ingredienti_ricetta_min", 'i', recipe_min_ingredients),
+    FIELD("ingredienti_ricetta_max", 'i', recipe_max_ingredients),
+    FIELD("dose_min", 'i', recipe_min_quantity), FIELD("dose_max", 'i', recipe_max_quantity),
+    FIELD("lotti_min", 'i', lots_min), FIELD("lotti_max", 'i', lots_max),
+    FIELD("quantita_lotto_min", 'i', lot_min_quantity), FIELD("quantita_lotto_max", 'i', lot_max_quantity),
+    FIELD("scadenza_min", 'i', expiration_min), FIELD("scadenza_max", 'i', expiration_max),
+    FIELD("ordine_min", 'i', order_min), FIELD("ordine_max", 'i', order_max),
+    FIELD("asimmetria", 'd', recipe_skew), FIELD("catalogo_iniziale", 'b', initial_catalog),
+    FIELD("peso_aggiungi", 'i', weight_add), FIELD("peso_rimuovi", 'i', weight_remove),
+    FIELD("peso_rifornimento", 'i', weight_supply), FIELD("peso_ordine", 'i', weight_order),
+};
+
+// Applica un profilo sopra quello misto, false se il nome non è noto
+bool apply_preset(Parameters *p, const char *name) {
+    preset_mixed(p);
+    if (strcmp(name, "misto") == 0) {
+        return true;
+    }
+    if (strcmp(name, "catalogo") == 0) {
+        // Catalogo enorme con nomi lunghi: stressa le hash table
+        p->recipes = 200000;
+        p->ingredients = 100000;
+        p->name_max = 60;
+        p->recipe_max_ingredients = 20;
+        p->weight_add = 40; p->weight_remove = 30; p->weight_supply = 10; p->weight_order = 20;
+        return true;
+    }
+    if (strcmp(name, "attesa") == 0) {
+        // Poche ricette molto richieste e rifornimenti scarsi: code di attesa lunghissime
+        p->recipes = 20;
+        p->ingredients = 40;
+        p->recipe_skew = 2.0;
+        p->lot_max_quantity = 300;
+        p->weight_add = 0; p->weight_remove = 1; p->weight_supply = 4; p->weight_order = 95;
+        return true;
+    }
+    if (strcmp(name, "lotti") == 0) {
+        // Molti rifornimenti con scadenze sparse: molti lotti per ingrediente
+        p->ingredients = 50;
+        p->lots_max = 30;
+        p->expiration_max = 100000;
+        p->weight_add = 1; p->weight_remove = 1; p->weight_supply = 70; p->weight_order = 28;
+        return true;
+    }
+    if (strcmp(name, "corriere") == 0) {
+        // Corriere capiente e frequente: carichi grandi da ordinare
+        p->courier_frequency = 10;
+        p->courier_capacity = 100000000;
+        p->lot_max_quantity = 100000;
+        p->weight_supply = 30; p->weight_order = 64;
+        return true;
+    }
+    return false;
+}
+
+// Imposta un parametro nome=valore, false se non valido
+bool set_parameter(Parameters *p, const char *argument) {
+    const char *equals = strchr(argument, '=');
+    if (equals == NULL) {
+        return false;
+    }
+    size_t length = equals - argument;
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        if (strlen(fields[i].name) != length || strncmp(fields[i].name, argument, length) != 0) {
+            continue;
+        }
+        char *target = (char *)p + fields[i].offset;
+        const char *value = equals + 1;
+        switch (fields[i].type) {
+            case 'u': *(unsigned long long *)target = strtoull(value, NULL, 10); break;
+            case 'l': *(long *)target = strtol(value, NULL, 10); break;
+            case 'i': *(int *)target = (int)strtol(value, NULL, 10); break;
+            case 'd': *(double *)target = strtod(value, NULL); break;
+            case 'b': *(bool *)target = strtol(value, NULL, 10) != 0; break;
+        }
+        return true;
+    }
+    return false;
+}
+
+// ****____****____****____****____**** NUMERI CASUALI ****____****____****____****____****
+
+// xoshiro256** inizializzato con splitmix64: stesso flusso su ogni piattaforma
+typedef struct {
+    unsigned long long s[4];
+} Random;
+
+unsigned long long splitmix64(unsigned long long *state) {
+    unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+void random_seed(Random *r, unsigned long long seed) {
+    for (int i = 0; i < 4; i++) {
+        r->s[i] = splitmix64(&seed);
+    }
+}
+
+unsigned long long rotl(unsigned long long x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+unsigned long long random_next(Random *r) {
+    unsigned long long *s = r->s;
+    unsigned long long result = rotl(s[1] * 5, 7) * 9;
+    unsigned long long t = s[1] << 17;
+    s[2] ^= s[0]; s[3] ^= s[1]; s[1] ^= s[2]; s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+// Reale uniforme in [0, 1)
+double random_unit(Random *r) {
+    return (random_next(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Intero uniforme in [min, max]
+int random_range(Random *r, int min, int max) {
+    if (max <= min) {
+        return min;
+    }
+    return min + (int)(random_next(r) % (unsigned long long)(max - min + 1));
+}
+
+// Indice in [0, n) con asimmetria: u^skew concentra le scelte sui primi indici
+int random_skewed(Random *r, int n, double skew) {
+    int index = (int)(pow(random_unit(r), skew) * n);
+    return index < n ? index : n - 1;
+}
+
+// ****____****____****____****____**** GENERAZIONE ****____****____****____****____****
+
+const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+
+// Crea count nomi distinti: un prefisso con l'indice garantisce l'unicità
+char **make_names(Random *r, const Parameters *p, int count, char prefix) {
+    char **names = malloc(count * sizeof(char *));
+    for (int i = 0; i < count; i++) {
+        int length = random_range(r, p->name_min, p->name_max);
+        names[i] = malloc(length + 24);
+        int written = sprintf(names[i], "%c%d_", prefix, i);
+        for (int j = 0; j < length; j++) {
+            names[i][written + j] = alphabet[random_next(r) % (sizeof(alphabet) - 1)];
+        }
+        names[i][written + length] = '\0';
+    }
+    return names;
+}
+
+void emit_add_recipe(Random *r, const Parameters *p, char **recipes, char **ingredients, int recipe, int *scratch) {
+    int count = random_range(r, p->recipe_min_ingredients, p->recipe_max_ingredients);
+    if (count > p->ingredients) {
+        count = p->ingredients;
+    }
+    fputs("aggiungi_ricetta ", stdout);
+    fputs(recipes[recipe], stdout);
+    // Ingredienti distinti con un Fisher-Yates parziale
+    for (int i = 0; i < count; i++) {
+        int j = random_range(r, i, p->ingredients - 1);
+        int temp = scratch[i]; scratch[i] = scratch[j]; scratch[j] = temp;
+        printf(" %s %d", ingredients[scratch[i]], random_range(r, p->recipe_min_quantity, p->recipe_max_quantity));
+    }
+    putchar('\n');
+}
+
+void emit_supply(Random *r, const Parameters *p, char **ingredients, long tick, int *scratch) {
+    int count = random_range(r, p->lots_min, p->lots_max);
+    if (count > p->ingredients) {
+        count = p->ingredients;
+    }
+    fputs("rifornimento", stdout);
+    for (int i = 0; i < count; i++) {
+        int j = random_range(r, i, p->ingredients - 1);
+        int temp = scratch[i]; scratch[i] = scratch[j]; scratch[j] = temp;
+        printf(" %s %d %ld", ingredients[scratch[i]],
+               random_range(r, p->lot_min_quantity, p->lot_max_quantity),
+               tick + random_range(r, p->expiration_min, p->expiration_max));
+    }
+    putchar('\n');
+}
+
+int main(int argc, char *argv[]) {
+    Parameters p;
+    int first = 1;
+    if (argc > 1 && strchr(argv[1], '=') == NULL) {
+        if (!apply_preset(&p, argv[1])) {
+            fprintf(stderr, "profilo sconosciuto: %s\n", argv[1]);
+            return 1;
+        }
+        first = 2;
+    } else {
+        preset_mixed(&p);
+    }
+    for (int i = first; i < argc; i++) {
+        if (!set_parameter(&p, argv[i])) {
+            fprintf(stderr, "parametro non valido: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (p.recipes < 1 || p.ingredients < 1 || p.courier_frequency < 1 || p.name_min < 1 || p.name_max < p.name_min) {
+        fprintf(stderr, "parametri incoerenti\n");
+        return 1;
+    }
+
+    Random r;
+    random_seed(&r, p.seed);
+    char **recipes = make_names(&r, &p, p.recipes, 'r');
+    char **ingredients = make_names(&r, &p, p.ingredients, 'i');
+    int *scratch = malloc(p.ingredients * sizeof(int));
+    for (int i = 0; i < p.ingredients; i++) {
+        scratch[i] = i;
+    }
+
+    printf("%d %d\n", p.courier_frequency, p.courier_capacity);
+    long tick = 0;
+    if (p.initial_catalog) {
+        for (int i = 0; i < p.recipes && tick < p.commands; i++, tick++) {
+            emit_add_recipe(&r, &p, recipes, ingredients, i, scratch);
+        }
+    }
+
+    int total_weight = p.weight_add + p.weight_remove + p.weight_supply + p.weight_order;
+    if (total_weight <= 0) {
+        fprintf(stderr, "la somma dei pesi dei comandi deve essere positiva\n");
+        return 1;
+    }
+    for (; tick < p.commands; tick++) {
+        int choice = random_range(&r, 0, total_weight - 1);
+        if ((choice -= p.weight_add) < 0) {
+            emit_add_recipe(&r, &p, recipes, ingredients, random_range(&r, 0, p.recipes - 1), scratch);
+        } else if ((choice -= p.weight_remove) < 0) {
+            printf("rimuovi_ricetta %s\n", recipes[random_skewed(&r, p.recipes, p.recipe_skew)]);
+        } else if ((choice -= p.weight_supply) < 0) {
+            emit_supply(&r, &p, ingredients, tick, scratch);
+        } else {
+            printf("ordine %s %d\n", recipes[random_skewed(&r, p.recipes, p.recipe_skew)],
+                   random_range(&r, p.order_min, p.order_max));
+        }
+    }
+
+    for (int i = 0; i < p.recipes; i++) {
+        free(recipes[i]);
+    }
+    for (int i = 0; i < p.ingredients; i++) {
+        free(ingredients[i]);
+    }
+    free(recipes);
+    free(ingredients);
+    free(scratch);
+    return 0;
+}
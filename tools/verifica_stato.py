@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""Verifica di --salva-stato / --carica-stato.
+
+Per ogni file di comandi (e per un caso interno con una ricetta senza ingredienti) divide
+l'input in piu' punti: la prima parte viene eseguita con --salva-stato, la seconda riparte
+con --carica-stato, e l'output concatenato deve coincidere con quello di un'unica esecuzione.
+Per il caso interno anche l'esecuzione unica viene confrontata con l'output atteso.
+
+Esempio:
+  tools/verifica_stato.py ./main public_test_cases/*.txt
+"""
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+# Una ricetta senza ingredienti, con ordini in attesa e pronti al momento del salvataggio
+EMPTY_RECIPE = b"""3 100
+aggiungi_ricetta vuota
+aggiungi_ricetta torta farina 5 uova 2
+ordine vuota 2
+rifornimento farina 20 50 uova 10 40
+ordine torta 1
+ordine vuota 1
+rimuovi_ricetta vuota
+aggiungi_ricetta vuota zucchero 1
+ordine vuota 1
+rifornimento zucchero 5 60
+"""
+EMPTY_RECIPE_OUTPUT = b"""aggiunta
+aggiunta
+accettato
+2 vuota 2
+rifornito
+accettato
+accettato
+4 torta 1
+5 vuota 1
+rimossa
+aggiunta
+accettato
+camioncino vuoto
+rifornito
+"""
+
+
+def run(args, data):
+    process = subprocess.run(args, input=data, stdout=subprocess.PIPE)
+    if process.returncode != 0:
+        return None
+    return process.stdout
+
+
+def check(binary, name, data, reference, splits, snapshot):
+    """Ritorna il numero di punti di divisione in cui il ripristino non coincide (piu' uno se
+    l'esecuzione unica fallisce o non coincide con reference, quando e' dato)."""
+    lines = data.splitlines(keepends=True)
+    expected = run([binary], data)
+    if expected is None:
+        print("%s: esecuzione fallita" % name)
+        return 1
+    if reference is not None and expected != reference:
+        print("%s: output diverso da quello atteso" % name)
+        return 1
+    commands = len(lines) - 1
+    points = sorted({1 + commands * k // (splits + 1) for k in range(1, splits + 1)} | {1, len(lines)})
+    failures = 0
+    for point in points:
+        first = run([binary, "--salva-stato", snapshot], b"".join(lines[:point]))
+        second = run([binary, "--carica-stato", snapshot], b"".join(lines[point:])) if first is not None else None
+        if second is None or first + second != expected:
+            print("%s: ripristino diverso dopo %d righe" % (name, point))
+            failures += 1
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Verifica del salvataggio e ripristino dello stato")
+    parser.add_argument("binario")
+    parser.add_argument("file", nargs="*", help="file di comandi")
+    parser.add_argument("--divisioni", type=int, default=8, help="punti di divisione per file")
+    args = parser.parse_args()
+
+    cases = [("ricetta senza ingredienti", EMPTY_RECIPE, EMPTY_RECIPE_OUTPUT)]
+    for path in args.file:
+        if path.endswith(".output.txt"):
+            continue  # Output attesi di public_test_cases, non comandi
+        with open(path, "rb") as f:
+            cases.append((path, f.read(), None))
+    failures = 0
+    with tempfile.TemporaryDirectory() as directory:
+        snapshot = os.path.join(directory, "stato.bin")
+        for name, data, reference in cases:
+            failures += check(args.binario, name, data, reference, args.divisioni, snapshot)
+    print("%d casi, %d verifiche fallite" % (len(cases), failures))
+    if failures:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()